@@ -0,0 +1,123 @@
+/** Microbenchmark of dispatching an event to plugins
+ *
+ * Usage: plugin_hooks [PLUGINS] [SUBSCRIBERS] [ITERATIONS]
+ *
+ * Load PLUGINS fake plugins (default 4), SUBSCRIBERS of them (default
+ * 0) handling DamageNotify, and dispatch it ITERATIONS times (default
+ * 100 millions) by walking the plugins list and checking each plugin,
+ * as UNAGI_PLUGINS_EVENT_HANDLE() did before, then with the macro
+ * itself through the arrays built by unagi_plugin_hooks_update(), and
+ * print the cost of each dispatch.  Built along with src/plugin.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "plugin.h"
+#include "structs.h"
+
+unagi_conf_t globalconf;
+
+static uint64_t _handled;
+
+static void __attribute__((noinline))
+_plugin_handle_damage(xcb_damage_notify_event_t *event, unagi_window_t *window)
+{
+  (void) event;
+  (void) window;
+  _handled++;
+}
+
+static double
+_bench_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+/** As UNAGI_PLUGINS_EVENT_HANDLE() did */
+static void __attribute__((noinline))
+_dispatch_list(xcb_damage_notify_event_t *event, unagi_window_t *window)
+{
+  for(unagi_plugin_t *plugin = globalconf.plugins; plugin;
+      plugin = plugin->next)
+    if(plugin->enable && plugin->vtable->activated &&
+       plugin->vtable->events.damage)
+      (*plugin->vtable->events.damage)(event, window);
+}
+
+static void __attribute__((noinline))
+_dispatch_hook(xcb_damage_notify_event_t *event, unagi_window_t *window)
+{
+  UNAGI_PLUGINS_EVENT_HANDLE(event, damage, window);
+}
+
+int
+main(int argc, char **argv)
+{
+  const unsigned int plugins_nb = argc > 1 ? (unsigned int) atoi(argv[1]) : 4;
+  const unsigned int subscribers_nb = argc > 2 ? (unsigned int) atoi(argv[2]) : 0;
+  const uint64_t iterations = argc > 3 ? strtoull(argv[3], NULL, 10) : 100000000;
+
+  if(subscribers_nb > plugins_nb || subscribers_nb > UNAGI_PLUGINS_HOOK_MAX ||
+     !iterations)
+    {
+      fprintf(stderr, "Usage: %s [PLUGINS] [SUBSCRIBERS <= %d] [ITERATIONS]\n",
+              argv[0], UNAGI_PLUGINS_HOOK_MAX);
+      return EXIT_FAILURE;
+    }
+
+  /* Allocated separately, as plugins loaded with dlopen() are */
+  for(unsigned int plugin_n = plugins_nb; plugin_n > 0; plugin_n--)
+    {
+      unagi_plugin_t *plugin = calloc(1, sizeof(unagi_plugin_t));
+      plugin->vtable = calloc(1, sizeof(unagi_plugin_vtable_t));
+      plugin->vtable->name = "fake";
+      plugin->vtable->activated = true;
+      plugin->enable = true;
+
+      if(plugin_n <= subscribers_nb)
+        plugin->vtable->events.damage = _plugin_handle_damage;
+
+      plugin->next = globalconf.plugins;
+      if(globalconf.plugins)
+        globalconf.plugins->prev = plugin;
+
+      globalconf.plugins = plugin;
+    }
+
+  unagi_plugin_hooks_update();
+
+  double start = _bench_now();
+  for(uint64_t i = 0; i < iterations; i++)
+    _dispatch_list(NULL, NULL);
+
+  const double list_time = _bench_now() - start;
+
+  start = _bench_now();
+  for(uint64_t i = 0; i < iterations; i++)
+    _dispatch_hook(NULL, NULL);
+
+  const double hook_time = _bench_now() - start;
+
+  printf("plugins: %u\n", plugins_nb);
+  printf("subscribers: %u\n", subscribers_nb);
+  printf("handled: %ju\n", (uintmax_t) _handled);
+  printf("dispatch_list_ns: %.3f\n", list_time * 1e9 / (double) iterations);
+  printf("dispatch_hook_ns: %.3f\n", hook_time * 1e9 / (double) iterations);
+
+  /* Not loaded with dlopen(), thus not unloaded by unagi_plugin_unload_all() */
+  while(globalconf.plugins)
+    {
+      unagi_plugin_t *plugin_next = globalconf.plugins->next;
+      free(globalconf.plugins->vtable);
+      free(globalconf.plugins);
+      globalconf.plugins = plugin_next;
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,114 @@
+#!/bin/sh
+#
+# Run xcbsync on a headless Xvfb server against synthetic workloads and
+# print its statistics for each of them.
+#
+# Usage: bench/run.sh [SCENARIO...]
+#
+# The "startup" scenario starts xcbsync once BENCH_STARTUP_WINDOWS windows
+# already exist, to measure how long managing them takes.
+#
+# Environment:
+#   BENCH_DISPLAY   display used by Xvfb (default :99)
+#   BENCH_SCREEN    Xvfb screen geometry (default 1920x1080x24)
+#   BENCH_WINDOWS   number of windows created by the workloads (default 16)
+#   BENCH_DURATION  duration of each workload in seconds (default 5)
+#   BENCH_STARTUP_WINDOWS
+#                   number of windows existing on startup (default 1000)
+#   XCBSYNC_FLAGS   extra xcbsync command line options
+
+set -e
+
+cd "$(dirname "$0")/.."
+
+BENCH_DISPLAY=${BENCH_DISPLAY:-:99}
+BENCH_SCREEN=${BENCH_SCREEN:-1920x1080x24}
+BENCH_WINDOWS=${BENCH_WINDOWS:-16}
+BENCH_DURATION=${BENCH_DURATION:-5}
+BENCH_STARTUP_WINDOWS=${BENCH_STARTUP_WINDOWS:-1000}
+
+SCENARIOS=${*:-startup map damage-small damage-full configure opacity}
+
+XVFB_PID=
+XCBSYNC_PID=
+WORKLOAD_PID=
+LOG=$(mktemp)
+
+cleanup() {
+    [ -n "$XCBSYNC_PID" ] && kill "$XCBSYNC_PID" 2>/dev/null || true
+    [ -n "$WORKLOAD_PID" ] && kill "$WORKLOAD_PID" 2>/dev/null || true
+    [ -n "$XVFB_PID" ] && kill "$XVFB_PID" 2>/dev/null || true
+    rm -f "$LOG"
+}
+trap cleanup EXIT INT TERM
+
+# Wait until a client can connect to the display
+wait_display() {
+    for _ in $(seq 50); do
+        xdpyinfo -display "$BENCH_DISPLAY" >/dev/null 2>&1 && return 0
+        sleep 0.1
+    done
+    echo "Xvfb did not start on $BENCH_DISPLAY" >&2
+    exit 1
+}
+
+Xvfb "$BENCH_DISPLAY" -screen 0 "$BENCH_SCREEN" -nolisten tcp \
+     +extension Composite +extension DAMAGE +extension RENDER \
+     +extension XFIXES >/dev/null 2>&1 &
+XVFB_PID=$!
+wait_display
+
+export DISPLAY="$BENCH_DISPLAY"
+
+# Stop xcbsync, which dumps its statistics on exit
+stop_xcbsync() {
+    kill "$XCBSYNC_PID"
+    wait "$XCBSYNC_PID" || true
+    XCBSYNC_PID=
+}
+
+bench_startup() {
+    bench/workload idle "$BENCH_STARTUP_WINDOWS" $((BENCH_DURATION + 3)) \
+                   >/dev/null &
+    WORKLOAD_PID=$!
+
+    # Let the workload create its windows
+    sleep 2
+
+    # shellcheck disable=SC2086
+    src/xcbsync --stats --rendering-dir=rendering/ --plugins-dir=plugins/ \
+                $XCBSYNC_FLAGS 2>"$LOG" &
+    XCBSYNC_PID=$!
+    sleep 1
+
+    echo "== startup ($BENCH_STARTUP_WINDOWS windows)"
+    stop_xcbsync
+
+    kill "$WORKLOAD_PID" 2>/dev/null || true
+    wait "$WORKLOAD_PID" || true
+    WORKLOAD_PID=
+
+    grep -E '^startup_[a-z_]+: ' "$LOG" || cat "$LOG" >&2
+}
+
+for scenario in $SCENARIOS; do
+    if [ "$scenario" = startup ]; then
+        bench_startup
+        continue
+    fi
+
+    # shellcheck disable=SC2086
+    src/xcbsync --stats --rendering-dir=rendering/ --plugins-dir=plugins/ \
+                $XCBSYNC_FLAGS 2>"$LOG" &
+    XCBSYNC_PID=$!
+
+    # Let the compositor redirect the screen before starting
+    sleep 1
+
+    echo "== $scenario ($BENCH_WINDOWS windows, ${BENCH_DURATION}s)"
+    bench/workload "$scenario" "$BENCH_WINDOWS" "$BENCH_DURATION"
+
+    stop_xcbsync
+
+    grep -E '^[a-z0-9_]+: ' "$LOG" || cat "$LOG" >&2
+done
@@ -0,0 +1,402 @@
+/** Synthetic X client workloads used to benchmark the compositor
+ *
+ * Usage: workload SCENARIO [WINDOWS] [SECONDS]
+ *
+ * Create WINDOWS top-level windows (default 16) and run SCENARIO for
+ * SECONDS (default 5) as fast as the X server processes the requests,
+ * then print the number of iterations per second (and the scenario
+ * specific results, such as the damage-to-composite latency).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include <xcb/xcb.h>
+
+#define WINDOW_WIDTH 200
+#define WINDOW_HEIGHT 150
+#define DAMAGE_SMALL_SIZE 8
+#define DAMAGE_SMALL_PER_WINDOW 16
+/** Give up waiting for a frame to be composited (seconds) */
+#define LATENCY_TIMEOUT 0.1
+
+typedef struct
+{
+  xcb_connection_t *connection;
+  xcb_screen_t *screen;
+  xcb_window_t *windows;
+  unsigned int windows_nb;
+  xcb_gcontext_t gc;
+  xcb_atom_t opacity_atom;
+  xcb_atom_t active_window_atom;
+  uint32_t iteration;
+  /** Damage-to-composite delays measured by the latency scenario */
+  double *latencies;
+  unsigned int latencies_len;
+  unsigned int latencies_size;
+  unsigned int latencies_timeouts;
+} workload_t;
+
+typedef struct
+{
+  const char *name;
+  void (*run)(workload_t *);
+  /** Print the scenario specific results, if any */
+  void (*report)(workload_t *);
+} scenario_t;
+
+static double
+_workload_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static inline void
+_workload_set_color(workload_t *w, const unsigned int window_n)
+{
+  const uint32_t color = (w->iteration * 0x050301 + window_n * 0x402010) & 0xffffff;
+  xcb_change_gc(w->connection, w->gc, XCB_GC_FOREGROUND, &color);
+}
+
+/** Map all the windows at even iterations and unmap them at odd ones */
+static void
+_workload_map(workload_t *w)
+{
+  for(unsigned int window_n = 0; window_n < w->windows_nb; window_n++)
+    if(w->iteration % 2)
+      xcb_unmap_window(w->connection, w->windows[window_n]);
+    else
+      xcb_map_window(w->connection, w->windows[window_n]);
+}
+
+/** Many small rectangles in each window, like a terminal or a text
+    editor */
+static void
+_workload_damage_small(workload_t *w)
+{
+  xcb_rectangle_t rects[DAMAGE_SMALL_PER_WINDOW];
+
+  for(unsigned int window_n = 0; window_n < w->windows_nb; window_n++)
+    {
+      _workload_set_color(w, window_n);
+
+      for(unsigned int rect_n = 0; rect_n < DAMAGE_SMALL_PER_WINDOW; rect_n++)
+        {
+          rects[rect_n].x = rand() % (WINDOW_WIDTH - DAMAGE_SMALL_SIZE);
+          rects[rect_n].y = rand() % (WINDOW_HEIGHT - DAMAGE_SMALL_SIZE);
+          rects[rect_n].width = rects[rect_n].height = DAMAGE_SMALL_SIZE;
+        }
+
+      /* One request per rectangle to get one DamageNotify each */
+      for(unsigned int rect_n = 0; rect_n < DAMAGE_SMALL_PER_WINDOW; rect_n++)
+        xcb_poly_fill_rectangle(w->connection, w->windows[window_n], w->gc,
+                                1, &rects[rect_n]);
+    }
+}
+
+/** Repaint each window entirely, like a video player */
+static void
+_workload_damage_full(workload_t *w)
+{
+  const xcb_rectangle_t rect = { 0, 0, WINDOW_WIDTH, WINDOW_HEIGHT };
+
+  for(unsigned int window_n = 0; window_n < w->windows_nb; window_n++)
+    {
+      _workload_set_color(w, window_n);
+      xcb_poly_fill_rectangle(w->connection, w->windows[window_n], w->gc,
+                              1, &rect);
+    }
+}
+
+/** Repaint each window entirely, with the first one being the active
+    window, like a video player next to other animated windows */
+static void
+_workload_damage_background(workload_t *w)
+{
+  if(!w->iteration)
+    xcb_change_property(w->connection, XCB_PROP_MODE_REPLACE,
+                        w->screen->root, w->active_window_atom,
+                        XCB_ATOM_WINDOW, 32, 1, &w->windows[0]);
+
+  _workload_damage_full(w);
+}
+
+/** Get the composited pixel at the given screen position, as the root
+    window content includes the compositor overlay window */
+static uint32_t
+_workload_get_screen_pixel(workload_t *w, const int16_t x, const int16_t y)
+{
+  xcb_get_image_reply_t *reply =
+    xcb_get_image_reply(w->connection,
+                        xcb_get_image(w->connection, XCB_IMAGE_FORMAT_Z_PIXMAP,
+                                      w->screen->root, x, y, 1, 1, ~0U),
+                        NULL);
+
+  uint32_t pixel = 0;
+  if(reply && xcb_get_image_data_length(reply) >= (int) sizeof(uint32_t))
+    memcpy(&pixel, xcb_get_image_data(reply), sizeof(uint32_t));
+
+  free(reply);
+  return pixel & 0xffffff;
+}
+
+/** Repaint a focused fullscreen window, like a game, and measure how
+    long it takes for the new content to be shown on the screen */
+static void
+_workload_latency(workload_t *w)
+{
+  const int16_t x = (int16_t) (w->screen->width_in_pixels / 2);
+  const int16_t y = (int16_t) (w->screen->height_in_pixels / 2);
+
+  if(!w->iteration)
+    {
+      const uint32_t values[] = {
+        0, 0, w->screen->width_in_pixels, w->screen->height_in_pixels,
+        XCB_STACK_MODE_ABOVE
+      };
+
+      xcb_configure_window(w->connection, w->windows[0],
+                           XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y |
+                           XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT |
+                           XCB_CONFIG_WINDOW_STACK_MODE, values);
+
+      xcb_change_property(w->connection, XCB_PROP_MODE_REPLACE,
+                          w->screen->root, w->active_window_atom,
+                          XCB_ATOM_WINDOW, 32, 1, &w->windows[0]);
+    }
+
+  const uint32_t color = (w->iteration * 0x050301 + 0x402010) & 0xffffff;
+  xcb_change_gc(w->connection, w->gc, XCB_GC_FOREGROUND, &color);
+
+  const xcb_rectangle_t rect = { (int16_t) (x - 32), (int16_t) (y - 32), 64, 64 };
+  xcb_poly_fill_rectangle(w->connection, w->windows[0], w->gc, 1, &rect);
+  xcb_flush(w->connection);
+
+  const double start = _workload_now();
+  double now;
+  bool is_shown;
+  do
+    {
+      is_shown = (_workload_get_screen_pixel(w, x, y) == color);
+      now = _workload_now();
+    }
+  while(!is_shown && now - start < LATENCY_TIMEOUT);
+
+  if(!is_shown)
+    {
+      w->latencies_timeouts++;
+      return;
+    }
+
+  if(w->latencies_len == w->latencies_size)
+    {
+      w->latencies_size = w->latencies_size ? w->latencies_size * 2 : 256;
+      w->latencies = realloc(w->latencies, w->latencies_size * sizeof(double));
+    }
+
+  w->latencies[w->latencies_len++] = now - start;
+}
+
+static int
+_workload_compare_latencies(const void *a, const void *b)
+{
+  const double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+static void
+_workload_latency_report(workload_t *w)
+{
+  printf("latency_samples: %u\n", w->latencies_len);
+  printf("latency_timeouts: %u\n", w->latencies_timeouts);
+
+  if(!w->latencies_len)
+    return;
+
+  qsort(w->latencies, w->latencies_len, sizeof(double), _workload_compare_latencies);
+
+  printf("latency_p50_ms: %.3f\n", w->latencies[w->latencies_len / 2] * 1000);
+  printf("latency_p99_ms: %.3f\n",
+         w->latencies[(unsigned int) ((w->latencies_len - 1) * 0.99)] * 1000);
+  printf("latency_max_ms: %.3f\n", w->latencies[w->latencies_len - 1] * 1000);
+}
+
+/** Move, resize and raise windows, like an interactive drag */
+static void
+_workload_configure(workload_t *w)
+{
+  const uint16_t mask = XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y |
+    XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT |
+    XCB_CONFIG_WINDOW_STACK_MODE;
+
+  for(unsigned int window_n = 0; window_n < w->windows_nb; window_n++)
+    {
+      const uint32_t offset = (w->iteration + window_n * 7) % 64;
+      const uint32_t values[] = {
+        (window_n * 37 + offset) % (w->screen->width_in_pixels - WINDOW_WIDTH),
+        (window_n * 23 + offset) % (w->screen->height_in_pixels - WINDOW_HEIGHT),
+        WINDOW_WIDTH - offset, WINDOW_HEIGHT - offset,
+        XCB_STACK_MODE_ABOVE
+      };
+
+      xcb_configure_window(w->connection, w->windows[window_n], mask, values);
+    }
+}
+
+/** Fade all the windows in and out through _NET_WM_WINDOW_OPACITY */
+static void
+_workload_opacity(workload_t *w)
+{
+  const uint32_t step = w->iteration % 32;
+  const uint32_t opacity = (uint32_t) (0xffffffffU / 32) *
+    (step < 16 ? 31 - step : step);
+
+  for(unsigned int window_n = 0; window_n < w->windows_nb; window_n++)
+    xcb_change_property(w->connection, XCB_PROP_MODE_REPLACE,
+                        w->windows[window_n], w->opacity_atom,
+                        XCB_ATOM_CARDINAL, 32, 1, &opacity);
+}
+
+/** Only keep the windows around, to measure the compositor startup */
+static void
+_workload_idle(workload_t *w __attribute__((unused)))
+{
+  const struct timespec delay = { 0, 10000000 };
+  nanosleep(&delay, NULL);
+}
+
+static const scenario_t _scenarios[] = {
+  { "map", _workload_map, NULL },
+  { "damage-small", _workload_damage_small, NULL },
+  { "damage-full", _workload_damage_full, NULL },
+  { "damage-background", _workload_damage_background, NULL },
+  { "configure", _workload_configure, NULL },
+  { "opacity", _workload_opacity, NULL },
+  { "idle", _workload_idle, NULL },
+  { "latency", _workload_latency, _workload_latency_report },
+  { NULL, NULL, NULL }
+};
+
+static void
+_workload_create_windows(workload_t *w)
+{
+  const uint32_t columns = w->screen->width_in_pixels / WINDOW_WIDTH;
+  const uint32_t values[] = { w->screen->white_pixel };
+
+  w->windows = calloc(w->windows_nb, sizeof(xcb_window_t));
+  for(unsigned int window_n = 0; window_n < w->windows_nb; window_n++)
+    {
+      w->windows[window_n] = xcb_generate_id(w->connection);
+
+      /* Overlap windows a bit when there are many of them */
+      xcb_create_window(w->connection, XCB_COPY_FROM_PARENT,
+                        w->windows[window_n], w->screen->root,
+                        (window_n % columns) * WINDOW_WIDTH + (window_n / columns) * 8 % 64,
+                        (window_n / columns) * WINDOW_HEIGHT % w->screen->height_in_pixels,
+                        WINDOW_WIDTH, WINDOW_HEIGHT, 0,
+                        XCB_WINDOW_CLASS_INPUT_OUTPUT, w->screen->root_visual,
+                        XCB_CW_BACK_PIXEL, values);
+
+      xcb_map_window(w->connection, w->windows[window_n]);
+    }
+
+  w->gc = xcb_generate_id(w->connection);
+  xcb_create_gc(w->connection, w->gc, w->windows[0], 0, NULL);
+}
+
+static xcb_atom_t
+_workload_intern_atom(workload_t *w, const char *name)
+{
+  xcb_intern_atom_reply_t *reply =
+    xcb_intern_atom_reply(w->connection,
+                          xcb_intern_atom(w->connection, false, strlen(name), name),
+                          NULL);
+
+  const xcb_atom_t atom = reply ? reply->atom : XCB_NONE;
+  free(reply);
+  return atom;
+}
+
+int
+main(int argc, char **argv)
+{
+  if(argc < 2)
+    {
+      fprintf(stderr, "Usage: %s SCENARIO [WINDOWS] [SECONDS]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  const scenario_t *scenario;
+  for(scenario = _scenarios; scenario->name; scenario++)
+    if(strcmp(scenario->name, argv[1]) == 0)
+      break;
+
+  if(!scenario->name)
+    {
+      fprintf(stderr, "Unknown scenario: %s\n", argv[1]);
+      return EXIT_FAILURE;
+    }
+
+  workload_t w;
+  memset(&w, 0, sizeof(workload_t));
+
+  w.windows_nb = argc > 2 ? (unsigned int) atoi(argv[2]) : 16;
+  const double duration = argc > 3 ? atof(argv[3]) : 5.0;
+  if(!w.windows_nb || duration <= 0)
+    {
+      fprintf(stderr, "Invalid number of windows or duration\n");
+      return EXIT_FAILURE;
+    }
+
+  int screen_nbr;
+  w.connection = xcb_connect(NULL, &screen_nbr);
+  if(xcb_connection_has_error(w.connection))
+    {
+      fprintf(stderr, "Cannot open display\n");
+      return EXIT_FAILURE;
+    }
+
+  xcb_screen_iterator_t iter = xcb_setup_roots_iterator(xcb_get_setup(w.connection));
+  for(; iter.rem && screen_nbr; screen_nbr--)
+    xcb_screen_next(&iter);
+
+  w.screen = iter.data;
+  w.opacity_atom = _workload_intern_atom(&w, "_NET_WM_WINDOW_OPACITY");
+  w.active_window_atom = _workload_intern_atom(&w, "_NET_ACTIVE_WINDOW");
+
+  _workload_create_windows(&w);
+  free(xcb_get_input_focus_reply(w.connection,
+                                 xcb_get_input_focus(w.connection), NULL));
+
+  const double start = _workload_now();
+  double now;
+  do
+    {
+      (*scenario->run)(&w);
+      w.iteration++;
+
+      /* Round trip to run at the X server pace rather than flooding it */
+      free(xcb_get_input_focus_reply(w.connection,
+                                     xcb_get_input_focus(w.connection), NULL));
+
+      now = _workload_now();
+    }
+  while(now - start < duration && !xcb_connection_has_error(w.connection));
+
+  printf("%s_iterations_per_second: %.2f\n", scenario->name,
+         (double) w.iteration / (now - start));
+
+  if(scenario->report)
+    (*scenario->report)(&w);
+
+  xcb_disconnect(w.connection);
+  free(w.windows);
+  free(w.latencies);
+  return EXIT_SUCCESS;
+}
@@ -9,6 +9,9 @@
 extern xcb_atom_t UNAGI__NET_WM_WINDOW_OPACITY;
 extern xcb_atom_t UNAGI__XROOTPMAP_ID;
 extern xcb_atom_t UNAGI__XSETROOT_ID;
+extern xcb_atom_t UNAGI__NET_WM_BYPASS_COMPOSITOR;
+extern xcb_atom_t UNAGI__NET_WM_FRAME_DRAWN;
+extern xcb_atom_t UNAGI__NET_WM_FRAME_TIMINGS;
 
 extern const xcb_atom_t *unagi_background_properties_atoms[];
 
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include <xcb/xcb.h>
+#include <xcb/sync.h>
+
+#include "window.h"
+
+/** Maximum time to wait for a client to draw after a resize (seconds),
+    the window being painted with its previous Pixmap meanwhile */
+#define UNAGI_CLIENT_RESIZE_TIMEOUT 0.2
+
+void unagi_client_manage(unagi_window_t *);
+void unagi_client_set_active(const xcb_window_t, const xcb_window_t);
+void unagi_client_property_notify(const xcb_property_notify_event_t *);
+void unagi_client_alarm_notify(const xcb_sync_alarm_notify_event_t *);
+void unagi_client_collect(void);
+bool unagi_client_update_bypass(void);
+bool unagi_client_is_unredirected(void);
+bool unagi_client_is_frame_pending(void);
+bool unagi_client_defer_resize(unagi_window_t *);
+void unagi_client_resize_flush(const double);
+double unagi_client_next_resize_time(void);
+void unagi_client_frames_drawn(void);
+void unagi_client_frames_presented(void);
+void unagi_client_stats_update(const double);
+void unagi_client_window_free(unagi_window_t *);
+void unagi_client_cleanup(void);
@@ -21,7 +21,10 @@ bool unagi_display_init_atoms_finalise(void);
 void unagi_display_init_redirect(void);
 void unagi_display_init_redirect_finalise(void);
 
+void unagi_display_add_damaged_extents(const xcb_rectangle_t *);
 void unagi_display_add_damaged_region(xcb_xfixes_region_t *, bool);
+void unagi_display_add_damaged_rectangle(const xcb_rectangle_t *);
+void unagi_display_flush_damaged(void);
 void unagi_display_reset_damaged(void);
 
 void unagi_display_update_screen_information(xcb_randr_get_screen_info_cookie_t,
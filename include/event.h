@@ -3,6 +3,12 @@
 #include <xcb/xcb.h>
 #include "display.h"
 
+/** Maximum number of events drained from the queue, and coalesced,
+    before being dispatched */
+#define UNAGI_EVENT_BATCH_MAX 256
+
+void unagi_event_log_error(const xcb_generic_error_t *);
 void unagi_event_handle_startup(xcb_generic_event_t *);
 void unagi_event_handle(xcb_generic_event_t *);
+unsigned int unagi_event_handle_batch(xcb_generic_event_t *(*)(xcb_connection_t *));
 void unagi_event_handle_poll_loop(void (*handler)(xcb_generic_event_t *));
\ No newline at end of file
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include <xcb/xcb.h>
+
+/** Number of events the reader thread may read ahead of the compositor
+    loop (must be a power of 2) */
+#define UNAGI_EVENT_READER_RING_SIZE 4096
+
+void unagi_event_reader_start(void);
+xcb_generic_event_t *unagi_event_reader_pop(xcb_connection_t *);
+void unagi_event_reader_wakeup(void);
+void unagi_event_reader_stop(void);
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdbool.h>
+
+/** How the completion of frames by the X server is tracked */
+typedef enum
+{
+  /** Sequence number of a request sent after the frame */
+  UNAGI_FRAME_SYNC_SEQUENCE = 0,
+  /** SYNC Fence triggered after the frame (needs SYNC >= 3.1) */
+  UNAGI_FRAME_SYNC_FENCE
+} unagi_frame_sync_mode_t;
+
+void unagi_frame_init(void);
+void unagi_frame_throttle(void);
+void unagi_frame_submit(void);
+void unagi_frame_cleanup(void);
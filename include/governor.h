@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+
+/** Painting quality tiers, each one also degrading what the previous
+    ones do */
+typedef enum
+{
+  /** Full quality */
+  UNAGI_GOVERNOR_TIER_NONE = 0,
+  /** Transformed windows use the "fast" filter rather than "good" */
+  UNAGI_GOVERNOR_TIER_FAST_FILTER,
+  /** Partial damage of a window is promoted to the whole window */
+  UNAGI_GOVERNOR_TIER_BOUNDING_DAMAGE,
+  /** Windows which are not focused are painted at half the rate */
+  UNAGI_GOVERNOR_TIER_HALF_RATE,
+  UNAGI_GOVERNOR_TIERS_NB
+} unagi_governor_tier_t;
+
+/** Number of consecutive frames over budget before degrading */
+#define UNAGI_GOVERNOR_OVERRUN_FRAMES 8
+
+/** Number of consecutive frames well under budget (half of it) before
+    restoring quality, much more than above to avoid oscillating */
+#define UNAGI_GOVERNOR_UNDERRUN_FRAMES 120
+
+void unagi_governor_frame(const float, const double);
+unagi_governor_tier_t unagi_governor_get_tier(void);
+const char *unagi_governor_get_tier_label(const unagi_governor_tier_t);
+void unagi_governor_stats_update(const double);
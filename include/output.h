@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include <xcb/xcb.h>
+#include <xcb/randr.h>
+
+/** Minimum interval between two DPMS state checks (seconds), either
+    when painting or while painting is suspended */
+#define UNAGI_OUTPUT_DPMS_CHECK_INTERVAL 1.0
+
+void unagi_output_crtcs_reset(void);
+void unagi_output_crtc_update(const xcb_randr_crtc_t, const xcb_randr_mode_t,
+                              const int16_t, const int16_t,
+                              const uint16_t, const uint16_t);
+void unagi_output_update(void);
+void unagi_output_dpms_check(const double);
+bool unagi_output_is_suspended(void);
+void unagi_output_clip_damaged(void);
+void unagi_output_cleanup(void);
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <xcb/xcb.h>
+#include <xcb/render.h>
+
+/** Number of buffer Pictures painted alternately by the compositor loop
+    and presented by the paint thread */
+#define UNAGI_PAINT_THREAD_BUFFERS 2
+
+void unagi_paint_thread_init(void);
+unsigned int unagi_paint_thread_acquire(void);
+void unagi_paint_thread_submit(xcb_render_picture_t, xcb_render_picture_t);
+uint64_t unagi_paint_thread_submitted(void);
+uint64_t unagi_paint_thread_presented(void);
+void unagi_paint_thread_wait_idle(void);
+void unagi_paint_thread_stop(void);
@@ -86,17 +86,65 @@ typedef struct _unagi_plugin_t
   struct _unagi_plugin_t *next;
 } unagi_plugin_t;
 
+/** Maximum number of plugins subscribed to a given hook */
+#define UNAGI_PLUGINS_HOOK_MAX 8
+
+/** Plugins subscribed to a given hook, in the plugins list order */
+typedef struct
+{
+  unsigned int len;
+  const unagi_plugin_vtable_t *vtables[UNAGI_PLUGINS_HOOK_MAX];
+} unagi_plugin_hook_t;
+
+/** Per-hook arrays of the plugins enabled and activated which define
+ *  it, so that dispatching an event costs nothing without subscribers.
+ *  They are only rebuilt by unagi_plugin_hooks_update(), which must be
+ *  called whenever a plugin is enabled or (de)activated
+ */
+typedef struct
+{
+  struct
+  {
+    unagi_plugin_hook_t damage;
+    unagi_plugin_hook_t randr_screen_change_notify;
+    unagi_plugin_hook_t key_press;
+    unagi_plugin_hook_t key_release;
+    unagi_plugin_hook_t mapping;
+    unagi_plugin_hook_t button_release;
+    unagi_plugin_hook_t motion_notify;
+    unagi_plugin_hook_t circulate;
+    unagi_plugin_hook_t configure;
+    unagi_plugin_hook_t create;
+    unagi_plugin_hook_t destroy;
+    unagi_plugin_hook_t map;
+    unagi_plugin_hook_t reparent;
+    unagi_plugin_hook_t unmap;
+    /** Also given to plugins not enabled yet, which may then meet
+        their requirements */
+    unagi_plugin_hook_t property;
+  } events;
+  unagi_plugin_hook_t window_get_opacity;
+  unagi_plugin_hook_t pre_paint;
+  unagi_plugin_hook_t post_paint;
+} unagi_plugin_hooks_t;
+
 /** Call the appropriate event handlers according to the event type */
 #define UNAGI_PLUGINS_EVENT_HANDLE(event, event_type, window)           \
-  for(unagi_plugin_t *plugin = globalconf.plugins; plugin;              \
-      plugin = plugin->next)						\
-    {									\
-      if(plugin->enable && plugin->vtable->activated &&                 \
-         plugin->vtable->events.event_type)                             \
-	(*plugin->vtable->events.event_type)(event, window);		\
-    }
+  for(unsigned int hook_n = 0;                                          \
+      hook_n < globalconf.plugins_hooks.events.event_type.len;          \
+      hook_n++)                                                         \
+    (*globalconf.plugins_hooks.events.event_type.vtables[hook_n]->events.event_type)(event, window)
+
+/** Call the given hook of the plugins subscribed to it */
+#define UNAGI_PLUGINS_HOOK_CALL(hook)                                   \
+  for(unsigned int hook_n = 0;                                          \
+      hook_n < globalconf.plugins_hooks.hook.len;                       \
+      hook_n++)                                                         \
+    (*globalconf.plugins_hooks.hook.vtables[hook_n]->hook)()
 
 void unagi_plugin_load_all(void);
 void unagi_plugin_check_requirements(void);
+void unagi_plugin_hooks_update(void);
+void unagi_plugin_property_notify(xcb_property_notify_event_t *, unagi_window_t *);
 unagi_plugin_t *unagi_plugin_search_by_name(const char *);
 void unagi_plugin_unload_all(void);
\ No newline at end of file
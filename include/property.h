@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include <xcb/xcb.h>
+
+#include "window.h"
+
+/** Number of hash table buckets of cached properties, as a power of two */
+#define UNAGI_PROPERTY_BUCKETS 256
+
+/** Maximum length of a cached property value (32-bits units), longer
+    values are truncated */
+#define UNAGI_PROPERTY_LENGTH_MAX 32
+
+/** Maximum number of atoms prefetched when a window is mapped */
+#define UNAGI_PROPERTY_WATCHED_MAX 16
+
+void unagi_property_watch(const xcb_atom_t);
+void unagi_property_prefetch(const xcb_window_t, const unsigned int,
+                             const xcb_atom_t *);
+void unagi_property_manage(const unagi_window_t *);
+bool unagi_property_poll(const xcb_window_t, const xcb_atom_t,
+                         const xcb_get_property_reply_t **);
+const xcb_get_property_reply_t *unagi_property_get(const xcb_window_t,
+                                                   const xcb_atom_t);
+void unagi_property_notify(const xcb_property_notify_event_t *);
+void unagi_property_collect(void);
+void unagi_property_window_remove(const xcb_window_t);
+void unagi_property_cleanup(void);
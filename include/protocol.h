@@ -0,0 +1,284 @@
+/** X requests accounting
+ *
+ * Wrap  the  XCB  functions  sending  the  requests  used  by  the
+ * compositor, the rendering backend and plugins, so that requests and
+ * bytes are  accounted per extension,  per frame and  per calling
+ * function (see unagi_stats_protocol_request()).
+ *
+ * This header must be included AFTER all the other headers because
+ * the macros would otherwise clash with the XCB functions prototypes.
+ * Besides, as the size of variable-length requests is computed from
+ * the  arguments, these  arguments  are evaluated  twice  and thus
+ * should not have side effects.
+ */
+
+#pragma once
+
+#include <xcb/xcb.h>
+#include <xcb/xproto.h>
+#include <xcb/xfixes.h>
+#include <xcb/damage.h>
+#include <xcb/render.h>
+#include <xcb/composite.h>
+#include <xcb/sync.h>
+#include <xcb/shape.h>
+
+#include "stats.h"
+
+#define _UNAGI_PROTOCOL_REQUEST(extension, request, bytes, call)        \
+  (unagi_stats_protocol_request(UNAGI_PROTOCOL_##extension, request,    \
+                                __func__, bytes), call)
+
+#define _UNAGI_PROTOCOL_FIXED(extension, request, type, call)           \
+  _UNAGI_PROTOCOL_REQUEST(extension, request, sizeof(type), call)
+
+/** Requests are padded to 4 bytes */
+#define _UNAGI_PROTOCOL_PAD(bytes) (((bytes) + 3) & ~3U)
+
+/** Size of a VALUE list given its mask */
+#define _UNAGI_PROTOCOL_VALUES(mask) (4 * __builtin_popcount(mask))
+
+/* Core protocol */
+#define xcb_get_window_attributes(c, ...)                               \
+  _UNAGI_PROTOCOL_FIXED(CORE, "GetWindowAttributes",                    \
+                        xcb_get_window_attributes_request_t,            \
+                        xcb_get_window_attributes(c, __VA_ARGS__))
+#define xcb_get_window_attributes_unchecked(c, ...)                     \
+  _UNAGI_PROTOCOL_FIXED(CORE, "GetWindowAttributes",                    \
+                        xcb_get_window_attributes_request_t,            \
+                        xcb_get_window_attributes_unchecked(c, __VA_ARGS__))
+#define xcb_change_window_attributes(c, window, value_mask, value_list) \
+  _UNAGI_PROTOCOL_REQUEST(CORE, "ChangeWindowAttributes",               \
+                          sizeof(xcb_change_window_attributes_request_t) + \
+                          _UNAGI_PROTOCOL_VALUES(value_mask),           \
+                          xcb_change_window_attributes(c, window, value_mask, \
+                                                       value_list))
+#define xcb_get_geometry(c, ...)                                        \
+  _UNAGI_PROTOCOL_FIXED(CORE, "GetGeometry", xcb_get_geometry_request_t, \
+                        xcb_get_geometry(c, __VA_ARGS__))
+#define xcb_get_geometry_unchecked(c, ...)                              \
+  _UNAGI_PROTOCOL_FIXED(CORE, "GetGeometry", xcb_get_geometry_request_t, \
+                        xcb_get_geometry_unchecked(c, __VA_ARGS__))
+#define xcb_get_property(c, ...)                                        \
+  _UNAGI_PROTOCOL_FIXED(CORE, "GetProperty", xcb_get_property_request_t, \
+                        xcb_get_property(c, __VA_ARGS__))
+#define xcb_get_property_unchecked(c, ...)                              \
+  _UNAGI_PROTOCOL_FIXED(CORE, "GetProperty", xcb_get_property_request_t, \
+                        xcb_get_property_unchecked(c, __VA_ARGS__))
+#define xcb_change_property(c, mode, window, property, type, format,   \
+                            data_len, data)                             \
+  _UNAGI_PROTOCOL_REQUEST(CORE, "ChangeProperty",                       \
+                          sizeof(xcb_change_property_request_t) +       \
+                          _UNAGI_PROTOCOL_PAD((data_len) * (format) / 8), \
+                          xcb_change_property(c, mode, window, property, \
+                                              type, format, data_len, data))
+#define xcb_query_tree(c, ...)                                          \
+  _UNAGI_PROTOCOL_FIXED(CORE, "QueryTree", xcb_query_tree_request_t,    \
+                        xcb_query_tree(c, __VA_ARGS__))
+#define xcb_query_tree_unchecked(c, ...)                                \
+  _UNAGI_PROTOCOL_FIXED(CORE, "QueryTree", xcb_query_tree_request_t,    \
+                        xcb_query_tree_unchecked(c, __VA_ARGS__))
+#define xcb_create_pixmap(c, ...)                                       \
+  _UNAGI_PROTOCOL_FIXED(CORE, "CreatePixmap", xcb_create_pixmap_request_t, \
+                        xcb_create_pixmap(c, __VA_ARGS__))
+#define xcb_free_pixmap(c, ...)                                         \
+  _UNAGI_PROTOCOL_FIXED(CORE, "FreePixmap", xcb_free_pixmap_request_t,  \
+                        xcb_free_pixmap(c, __VA_ARGS__))
+#define xcb_send_event(c, ...)                                          \
+  _UNAGI_PROTOCOL_FIXED(CORE, "SendEvent", xcb_send_event_request_t,    \
+                        xcb_send_event(c, __VA_ARGS__))
+#define xcb_get_input_focus(c)                                          \
+  _UNAGI_PROTOCOL_FIXED(CORE, "GetInputFocus", xcb_get_input_focus_request_t, \
+                        xcb_get_input_focus(c))
+#define xcb_get_input_focus_unchecked(c)                                \
+  _UNAGI_PROTOCOL_FIXED(CORE, "GetInputFocus", xcb_get_input_focus_request_t, \
+                        xcb_get_input_focus_unchecked(c))
+
+/* XFixes */
+#define xcb_xfixes_create_region(c, region, rects_len, rects)           \
+  _UNAGI_PROTOCOL_REQUEST(XFIXES, "CreateRegion",                       \
+                          sizeof(xcb_xfixes_create_region_request_t) +  \
+                          (rects_len) * sizeof(xcb_rectangle_t),        \
+                          xcb_xfixes_create_region(c, region, rects_len, rects))
+#define xcb_xfixes_set_region(c, region, rects_len, rects)              \
+  _UNAGI_PROTOCOL_REQUEST(XFIXES, "SetRegion",                          \
+                          sizeof(xcb_xfixes_set_region_request_t) +     \
+                          (rects_len) * sizeof(xcb_rectangle_t),        \
+                          xcb_xfixes_set_region(c, region, rects_len, rects))
+#define xcb_xfixes_create_region_from_window(c, ...)                    \
+  _UNAGI_PROTOCOL_FIXED(XFIXES, "CreateRegionFromWindow",               \
+                        xcb_xfixes_create_region_from_window_request_t, \
+                        xcb_xfixes_create_region_from_window(c, __VA_ARGS__))
+#define xcb_xfixes_destroy_region(c, ...)                               \
+  _UNAGI_PROTOCOL_FIXED(XFIXES, "DestroyRegion",                        \
+                        xcb_xfixes_destroy_region_request_t,            \
+                        xcb_xfixes_destroy_region(c, __VA_ARGS__))
+#define xcb_xfixes_copy_region(c, ...)                                  \
+  _UNAGI_PROTOCOL_FIXED(XFIXES, "CopyRegion", xcb_xfixes_copy_region_request_t, \
+                        xcb_xfixes_copy_region(c, __VA_ARGS__))
+#define xcb_xfixes_union_region(c, ...)                                 \
+  _UNAGI_PROTOCOL_FIXED(XFIXES, "UnionRegion", xcb_xfixes_union_region_request_t, \
+                        xcb_xfixes_union_region(c, __VA_ARGS__))
+#define xcb_xfixes_intersect_region(c, ...)                             \
+  _UNAGI_PROTOCOL_FIXED(XFIXES, "IntersectRegion",                      \
+                        xcb_xfixes_intersect_region_request_t,          \
+                        xcb_xfixes_intersect_region(c, __VA_ARGS__))
+#define xcb_xfixes_subtract_region(c, ...)                              \
+  _UNAGI_PROTOCOL_FIXED(XFIXES, "SubtractRegion",                       \
+                        xcb_xfixes_subtract_region_request_t,           \
+                        xcb_xfixes_subtract_region(c, __VA_ARGS__))
+#define xcb_xfixes_translate_region(c, ...)                             \
+  _UNAGI_PROTOCOL_FIXED(XFIXES, "TranslateRegion",                      \
+                        xcb_xfixes_translate_region_request_t,          \
+                        xcb_xfixes_translate_region(c, __VA_ARGS__))
+#define xcb_xfixes_fetch_region(c, ...)                                 \
+  _UNAGI_PROTOCOL_FIXED(XFIXES, "FetchRegion", xcb_xfixes_fetch_region_request_t, \
+                        xcb_xfixes_fetch_region(c, __VA_ARGS__))
+#define xcb_xfixes_fetch_region_unchecked(c, ...)                       \
+  _UNAGI_PROTOCOL_FIXED(XFIXES, "FetchRegion", xcb_xfixes_fetch_region_request_t, \
+                        xcb_xfixes_fetch_region_unchecked(c, __VA_ARGS__))
+#define xcb_xfixes_set_picture_clip_region(c, ...)                      \
+  _UNAGI_PROTOCOL_FIXED(XFIXES, "SetPictureClipRegion",                 \
+                        xcb_xfixes_set_picture_clip_region_request_t,   \
+                        xcb_xfixes_set_picture_clip_region(c, __VA_ARGS__))
+#define xcb_xfixes_set_window_shape_region(c, ...)                      \
+  _UNAGI_PROTOCOL_FIXED(XFIXES, "SetWindowShapeRegion",                 \
+                        xcb_xfixes_set_window_shape_region_request_t,   \
+                        xcb_xfixes_set_window_shape_region(c, __VA_ARGS__))
+
+/* Damage */
+#define xcb_damage_create(c, ...)                                       \
+  _UNAGI_PROTOCOL_FIXED(DAMAGE, "Create", xcb_damage_create_request_t,  \
+                        xcb_damage_create(c, __VA_ARGS__))
+#define xcb_damage_create_checked(c, ...)                               \
+  _UNAGI_PROTOCOL_FIXED(DAMAGE, "Create", xcb_damage_create_request_t,  \
+                        xcb_damage_create_checked(c, __VA_ARGS__))
+#define xcb_damage_destroy(c, ...)                                      \
+  _UNAGI_PROTOCOL_FIXED(DAMAGE, "Destroy", xcb_damage_destroy_request_t, \
+                        xcb_damage_destroy(c, __VA_ARGS__))
+#define xcb_damage_subtract(c, ...)                                     \
+  _UNAGI_PROTOCOL_FIXED(DAMAGE, "Subtract", xcb_damage_subtract_request_t, \
+                        xcb_damage_subtract(c, __VA_ARGS__))
+#define xcb_damage_add(c, ...)                                          \
+  _UNAGI_PROTOCOL_FIXED(DAMAGE, "Add", xcb_damage_add_request_t,        \
+                        xcb_damage_add(c, __VA_ARGS__))
+
+/* Render */
+#define xcb_render_create_picture(c, pid, drawable, format, value_mask, \
+                                  value_list)                           \
+  _UNAGI_PROTOCOL_REQUEST(RENDER, "CreatePicture",                      \
+                          sizeof(xcb_render_create_picture_request_t) + \
+                          _UNAGI_PROTOCOL_VALUES(value_mask),           \
+                          xcb_render_create_picture(c, pid, drawable, format, \
+                                                    value_mask, value_list))
+#define xcb_render_create_picture_checked(c, pid, drawable, format,    \
+                                          value_mask, value_list)       \
+  _UNAGI_PROTOCOL_REQUEST(RENDER, "CreatePicture",                      \
+                          sizeof(xcb_render_create_picture_request_t) + \
+                          _UNAGI_PROTOCOL_VALUES(value_mask),           \
+                          xcb_render_create_picture_checked(c, pid, drawable, \
+                                                            format, value_mask, \
+                                                            value_list))
+#define xcb_render_change_picture(c, picture, value_mask, value_list)   \
+  _UNAGI_PROTOCOL_REQUEST(RENDER, "ChangePicture",                      \
+                          sizeof(xcb_render_change_picture_request_t) + \
+                          _UNAGI_PROTOCOL_VALUES(value_mask),           \
+                          xcb_render_change_picture(c, picture, value_mask, \
+                                                    value_list))
+#define xcb_render_free_picture(c, ...)                                 \
+  _UNAGI_PROTOCOL_FIXED(RENDER, "FreePicture", xcb_render_free_picture_request_t, \
+                        xcb_render_free_picture(c, __VA_ARGS__))
+#define xcb_render_composite(c, ...)                                    \
+  _UNAGI_PROTOCOL_FIXED(RENDER, "Composite", xcb_render_composite_request_t, \
+                        xcb_render_composite(c, __VA_ARGS__))
+#define xcb_render_fill_rectangles(c, op, dst, color, rects_len, rects) \
+  _UNAGI_PROTOCOL_REQUEST(RENDER, "FillRectangles",                     \
+                          sizeof(xcb_render_fill_rectangles_request_t) + \
+                          (rects_len) * sizeof(xcb_rectangle_t),        \
+                          xcb_render_fill_rectangles(c, op, dst, color, \
+                                                     rects_len, rects))
+#define xcb_render_set_picture_clip_rectangles(c, picture, x, y,       \
+                                               rects_len, rects)        \
+  _UNAGI_PROTOCOL_REQUEST(RENDER, "SetPictureClipRectangles",           \
+                          sizeof(xcb_render_set_picture_clip_rectangles_request_t) + \
+                          (rects_len) * sizeof(xcb_rectangle_t),        \
+                          xcb_render_set_picture_clip_rectangles(c, picture, x, y, \
+                                                                 rects_len, rects))
+#define xcb_render_set_picture_transform(c, ...)                        \
+  _UNAGI_PROTOCOL_FIXED(RENDER, "SetPictureTransform",                  \
+                        xcb_render_set_picture_transform_request_t,     \
+                        xcb_render_set_picture_transform(c, __VA_ARGS__))
+#define xcb_render_set_picture_filter(c, picture, filter_len, filter,  \
+                                      values_len, values)               \
+  _UNAGI_PROTOCOL_REQUEST(RENDER, "SetPictureFilter",                   \
+                          sizeof(xcb_render_set_picture_filter_request_t) + \
+                          _UNAGI_PROTOCOL_PAD(filter_len) +             \
+                          (values_len) * sizeof(xcb_render_fixed_t),    \
+                          xcb_render_set_picture_filter(c, picture, filter_len, \
+                                                        filter, values_len, \
+                                                        values))
+
+/* Composite */
+#define xcb_composite_redirect_subwindows(c, ...)                       \
+  _UNAGI_PROTOCOL_FIXED(COMPOSITE, "RedirectSubwindows",                \
+                        xcb_composite_redirect_subwindows_request_t,    \
+                        xcb_composite_redirect_subwindows(c, __VA_ARGS__))
+#define xcb_composite_unredirect_subwindows(c, ...)                     \
+  _UNAGI_PROTOCOL_FIXED(COMPOSITE, "UnredirectSubwindows",              \
+                        xcb_composite_unredirect_subwindows_request_t,  \
+                        xcb_composite_unredirect_subwindows(c, __VA_ARGS__))
+#define xcb_composite_name_window_pixmap(c, ...)                        \
+  _UNAGI_PROTOCOL_FIXED(COMPOSITE, "NameWindowPixmap",                  \
+                        xcb_composite_name_window_pixmap_request_t,     \
+                        xcb_composite_name_window_pixmap(c, __VA_ARGS__))
+#define xcb_composite_get_overlay_window_unchecked(c, ...)              \
+  _UNAGI_PROTOCOL_FIXED(COMPOSITE, "GetOverlayWindow",                  \
+                        xcb_composite_get_overlay_window_request_t,     \
+                        xcb_composite_get_overlay_window_unchecked(c, __VA_ARGS__))
+#define xcb_composite_release_overlay_window(c, ...)                    \
+  _UNAGI_PROTOCOL_FIXED(COMPOSITE, "ReleaseOverlayWindow",              \
+                        xcb_composite_release_overlay_window_request_t, \
+                        xcb_composite_release_overlay_window(c, __VA_ARGS__))
+
+/* SYNC */
+#define xcb_sync_create_fence(c, ...)                                   \
+  _UNAGI_PROTOCOL_FIXED(SYNC, "CreateFence", xcb_sync_create_fence_request_t, \
+                        xcb_sync_create_fence(c, __VA_ARGS__))
+#define xcb_sync_destroy_fence(c, ...)                                  \
+  _UNAGI_PROTOCOL_FIXED(SYNC, "DestroyFence", xcb_sync_destroy_fence_request_t, \
+                        xcb_sync_destroy_fence(c, __VA_ARGS__))
+#define xcb_sync_trigger_fence(c, ...)                                  \
+  _UNAGI_PROTOCOL_FIXED(SYNC, "TriggerFence", xcb_sync_trigger_fence_request_t, \
+                        xcb_sync_trigger_fence(c, __VA_ARGS__))
+#define xcb_sync_reset_fence(c, ...)                                    \
+  _UNAGI_PROTOCOL_FIXED(SYNC, "ResetFence", xcb_sync_reset_fence_request_t, \
+                        xcb_sync_reset_fence(c, __VA_ARGS__))
+#define xcb_sync_query_fence_unchecked(c, ...)                          \
+  _UNAGI_PROTOCOL_FIXED(SYNC, "QueryFence", xcb_sync_query_fence_request_t, \
+                        xcb_sync_query_fence_unchecked(c, __VA_ARGS__))
+/* The 64-bit VALUE and DELTA take two words */
+#define xcb_sync_create_alarm(c, id, value_mask, value_list)            \
+  _UNAGI_PROTOCOL_REQUEST(SYNC, "CreateAlarm",                          \
+                          sizeof(xcb_sync_create_alarm_request_t) +     \
+                          _UNAGI_PROTOCOL_VALUES(value_mask) +          \
+                          _UNAGI_PROTOCOL_VALUES((value_mask) &         \
+                                                 (XCB_SYNC_CA_VALUE |   \
+                                                  XCB_SYNC_CA_DELTA)),  \
+                          xcb_sync_create_alarm(c, id, value_mask, value_list))
+#define xcb_sync_destroy_alarm(c, ...)                                  \
+  _UNAGI_PROTOCOL_FIXED(SYNC, "DestroyAlarm", xcb_sync_destroy_alarm_request_t, \
+                        xcb_sync_destroy_alarm(c, __VA_ARGS__))
+#define xcb_sync_await_fence(c, fence_list_len, fence_list)             \
+  _UNAGI_PROTOCOL_REQUEST(SYNC, "AwaitFence",                           \
+                          sizeof(xcb_sync_await_fence_request_t) +      \
+                          (fence_list_len) * sizeof(xcb_sync_fence_t),  \
+                          xcb_sync_await_fence(c, fence_list_len, fence_list))
+
+/* Shape */
+#define xcb_shape_select_input(c, ...)                                  \
+  _UNAGI_PROTOCOL_FIXED(SHAPE, "SelectInput", xcb_shape_select_input_request_t, \
+                        xcb_shape_select_input(c, __VA_ARGS__))
+#define xcb_shape_get_rectangles(c, ...)                                \
+  _UNAGI_PROTOCOL_FIXED(SHAPE, "GetRectangles",                         \
+                        xcb_shape_get_rectangles_request_t,             \
+                        xcb_shape_get_rectangles(c, __VA_ARGS__))
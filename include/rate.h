@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include <xcb/xcb.h>
+
+#include "window.h"
+
+void unagi_rate_init(void);
+void unagi_rate_update_active(void);
+bool unagi_rate_is_active_fullscreen(const unagi_window_t *);
+bool unagi_rate_defer_damage(unagi_window_t *, const xcb_rectangle_t *);
+void unagi_rate_window_remove(unagi_window_t *);
+void unagi_rate_flush(const double);
+double unagi_rate_next_flush_time(void);
+void unagi_rate_cleanup(void);
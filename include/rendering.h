@@ -12,8 +12,10 @@ typedef struct
   bool (*init) (void);
   /** Second step of the initialisation routine */
   bool (*init_finalise) (void);
-  /** Reset the root Window background */
+  /** Reset the root Window background when its image has changed */
   void (*reset_background) (void);
+  /** Reset the root Window Pictures when it has been resized */
+  void (*reset_root) (void);
   /** Paint the root background to the root window */
   void (*paint_background) (void);
   /** Paint a given window */
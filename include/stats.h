@@ -0,0 +1,168 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <xcb/xcb.h>
+
+#include "governor.h"
+
+/** Paint times histogram resolution (seconds) */
+#define UNAGI_STATS_PAINT_TIME_RESOLUTION 0.0001
+/** Paint times histogram size, the last bucket holds longer times */
+#define UNAGI_STATS_PAINT_TIME_BUCKETS 1000
+
+/** Events latency histograms resolution (milliseconds, as X server
+    timestamps) and size */
+#define UNAGI_STATS_EVENT_LATENCY_BUCKETS 1000
+
+/** Maximum number of (request, calling function) pairs accounted */
+#define UNAGI_STATS_PROTOCOL_CALLS_MAX 256
+
+/** X extensions whose requests are accounted (see protocol.h) */
+typedef enum
+{
+  UNAGI_PROTOCOL_CORE = 0,
+  UNAGI_PROTOCOL_XFIXES,
+  UNAGI_PROTOCOL_DAMAGE,
+  UNAGI_PROTOCOL_RENDER,
+  UNAGI_PROTOCOL_COMPOSITE,
+  UNAGI_PROTOCOL_SYNC,
+  UNAGI_PROTOCOL_SHAPE,
+  UNAGI_PROTOCOL_EXTENSIONS_NB
+} unagi_protocol_extension_t;
+
+/** Requests sent by a given function */
+typedef struct
+{
+  /** Request name and calling function (string literals, thus compared
+      by address) */
+  const char *request;
+  const char *function;
+  unagi_protocol_extension_t extension;
+  uint64_t requests;
+  uint64_t bytes;
+} unagi_stats_protocol_call_t;
+
+/** Requests sent for a given extension */
+typedef struct
+{
+  uint64_t requests;
+  uint64_t bytes;
+  /** Since the last frame */
+  uint64_t frame_requests;
+  uint64_t frame_bytes;
+  uint64_t frame_requests_max;
+  uint64_t frame_bytes_max;
+} unagi_stats_protocol_extension_t;
+
+/** Counters  about painting and  the X server, meaningful  to measure
+ *  the compositor behaviour without a profiler
+ */
+typedef struct
+{
+  /** When statistics started to be collected */
+  double start_time;
+  /** Time elapsed until the first frame has been painted (seconds) */
+  double startup_time;
+  /** Number of windows existing on startup */
+  unsigned int startup_windows;
+  /** Damage objects created  once windows are viewable, and released
+      with Pixmaps when they have been unmapped for a while */
+  uint64_t damage_created;
+  uint64_t damage_released;
+  uint64_t pixmaps_released;
+  /** Number of NameWindowPixmap requests (each comes with a new Picture) */
+  uint64_t pixmaps_named;
+  /** Number of windows painted, only the ones overlapping the damaged
+      area are */
+  uint64_t windows_painted;
+  /** Number of frames painted */
+  uint64_t frames;
+  /** Number of times the event loop has been woken up */
+  uint64_t wakeups;
+  /** Number of X events handled */
+  uint64_t events;
+  /** Number of X events dropped because superseded by later ones */
+  uint64_t events_coalesced;
+  /** Delay between the X server  generating an event (PropertyNotify
+      timestamp)  and  the  compositor  reading  it  from  the  X
+      connection, then handling it */
+  uint32_t event_read_latency_histogram[UNAGI_STATS_EVENT_LATENCY_BUCKETS];
+  uint32_t event_handle_latency_histogram[UNAGI_STATS_EVENT_LATENCY_BUCKETS];
+  /** Number of X requests sent between two frames (including the ones
+      sent by event handlers) */
+  uint64_t requests;
+  /** Sequence number of the last frame tracking request */
+  unsigned int last_frame_sequence;
+  /** Histogram of paint times, for percentiles */
+  uint32_t paint_time_histogram[UNAGI_STATS_PAINT_TIME_BUCKETS];
+  double paint_time_max;
+  /** Number of frames which had to wait for the X server */
+  uint64_t frames_throttled;
+  /** Time spent waiting for the X server (seconds) */
+  double throttle_wait_time;
+  /** Delay between sending a frame and knowing it has been processed
+      by the X server (seconds) */
+  double server_lag_sum;
+  double server_lag_max;
+  uint64_t server_lag_count;
+  /** Frames whose  rendering was not finished yet  when the X server
+      started processing the frame reusing their Fence */
+  uint64_t fence_stalls;
+  /** Frames which had to wait for the paint thread to present the
+      frame previously painted in the same buffer */
+  uint64_t present_waits;
+  /** Time spent waiting for the paint thread (seconds) */
+  double present_wait_time;
+  /** Number of times painting has been suspended as all outputs were
+      off, and for how long (seconds) */
+  uint64_t outputs_suspensions;
+  double outputs_suspended_time;
+  /** DamageNotify events of background windows deferred, and how many
+      times their accumulated damage has been painted */
+  uint64_t background_deferred;
+  uint64_t background_flushes;
+  /** Frames painted right away in low-latency mode */
+  uint64_t frames_immediate;
+  /** Number of times the governor has degraded or restored painting
+      quality, and time spent in each tier (seconds) */
+  uint64_t governor_degradations;
+  uint64_t governor_restorations;
+  double governor_tier_time[UNAGI_GOVERNOR_TIERS_NB];
+  /** Number of times all windows have been unredirected for a window
+      bypassing the compositor, and for how long (seconds) */
+  uint64_t bypass_unredirections;
+  double bypass_time;
+  /** _NET_WM_FRAME_DRAWN messages sent to clients syncing their frames */
+  uint64_t frames_drawn_reported;
+  /** Resized windows painted with their previous Pixmap until their
+      client has drawn, and how many did so in time */
+  uint64_t resizes_deferred;
+  uint64_t resizes_synced;
+  /** GetProperty requests sent by the property cache, and lookups
+      answered from it */
+  uint64_t property_requests;
+  uint64_t property_hits;
+  /** Whether X requests are accounted (only when statistics have been
+      requested as it costs a lookup per request) */
+  bool protocol_enabled;
+  unagi_stats_protocol_extension_t protocol[UNAGI_PROTOCOL_EXTENSIONS_NB];
+  /** Open addressing hash table of requests per calling function */
+  unagi_stats_protocol_call_t protocol_calls[UNAGI_STATS_PROTOCOL_CALLS_MAX];
+  /** Requests which did not fit in the table above */
+  uint64_t protocol_calls_dropped;
+} unagi_stats_t;
+
+void unagi_stats_init(void);
+void unagi_stats_server_lag(const double);
+void unagi_stats_paint_time(const double);
+void unagi_stats_frame_sequence(const unsigned int);
+uint32_t unagi_stats_server_time(void);
+void unagi_stats_event_read(const xcb_generic_event_t *, const uint32_t);
+void unagi_stats_event_handle(const uint32_t);
+void unagi_stats_protocol_request(const unagi_protocol_extension_t,
+                                  const char *, const char *, const size_t);
+void unagi_stats_protocol_frame(void);
+void unagi_stats_dump(FILE *);
@@ -5,6 +5,9 @@
 #include <xcb/xcb_ewmh.h>
 #include <xcb/xfixes.h>
 #include <xcb/randr.h>
+#include <xcb/sync.h>
+#include <xcb/shape.h>
+#include <xcb/dpms.h>
 
 #include <confuse.h>
 #include <ev.h>
@@ -14,6 +17,8 @@
 #include "plugin.h"
 #include "atoms.h"
 #include "util.h"
+#include "frame.h"
+#include "stats.h"
 
 /** Hold information related to the X extension */
 typedef struct _unagi_display_extensions_t
@@ -26,6 +31,15 @@ typedef struct _unagi_display_extensions_t
   const xcb_query_extension_reply_t *damage;
   /** The RandR extension information */
   const xcb_query_extension_reply_t *randr;
+  /** The SYNC extension information (NULL if Fences are not supported) */
+  const xcb_query_extension_reply_t *sync;
+  /** The Shape extension information (NULL if not available, then all
+      windows are rectangular) */
+  const xcb_query_extension_reply_t *shape;
+  /** The DPMS extension information (NULL if not available) */
+  const xcb_query_extension_reply_t *dpms;
+  /** Whether RandR reports CRTC changes (version >= 1.2) */
+  bool randr_crtc_notify;
 } unagi_display_extensions_t;
 
 //20ms (60Hz)
@@ -37,6 +51,14 @@ typedef struct _unagi_display_extensions_t
 //5ms (200Hz)
 #define MINIMUM_REPAINT_INTERVAL (float)0.005
 
+/** Default number of frames the X  server may still be processing
+    before the next one is painted, beyond that painting waits for the
+    server */
+#define UNAGI_FRAMES_IN_FLIGHT 1
+
+/** Size of the ring of frames sent but not known to be processed */
+#define UNAGI_FRAMES_IN_FLIGHT_MAX 4
+
 /** Global structure holding variables used all across the program */
 typedef struct _unagi_conf_t
 {
@@ -45,9 +67,27 @@ typedef struct _unagi_conf_t
   /** libev I/O watcher on XCB FD, invoked in paint callback to ensure
       that no events have been queued while calling the callback */
   ev_io event_io_watcher;
-  /** libev paint timer watcher to be reset according to the painting
-      average time */
+  /** libev  one-shot paint timer watcher,  only armed when there is
+      something to paint (see _unagi_paint_schedule()) */
   ev_timer event_paint_timer_watcher;
+  /** When the next painting is expected from the last one, painting is
+      kept aligned on this time plus a multiple of the refresh rate */
+  ev_tstamp paint_next_time;
+  /** libev timer watcher checking DPMS state, only active while painting
+      is suspended as all outputs are off */
+  ev_timer event_output_timer_watcher;
+  /** libev watcher counting the event loop wakeups */
+  ev_check event_wakeup_check_watcher;
+  /** libev timer watcher releasing resources of unmapped windows, only
+      active when there are such windows */
+  ev_timer event_release_timer_watcher;
+  /** Read events from a dedicated thread rather than the loop */
+  bool threaded_events;
+  /** libev watcher woken up by the events reader thread */
+  ev_async event_async_watcher;
+  /** libev watcher woken up by the paint thread once a frame has been
+      presented */
+  ev_async event_present_watcher;
 
   /** The XCB connection structure */
   xcb_connection_t *connection;
@@ -67,19 +107,94 @@ typedef struct _unagi_conf_t
   float paint_time_sum;
   /** Numbre of paintings (for calculating the global average) */
   unsigned int paint_counter;
+  /** Frames sent to the  X server but whose processing has not been
+      acknowledged yet, oldest first. Each frame is tracked through the
+      sequence number of a request sent right after its last Composite
+      and whose reply is only polled, never waited for unless the server
+      lags more than UNAGI_FRAMES_IN_FLIGHT frames behind */
+  struct
+  {
+    /** How the completion of frames is tracked */
+    unagi_frame_sync_mode_t mode;
+    /** Maximum number of frames in flight */
+    unsigned int max_len;
+    xcb_get_input_focus_cookie_t cookies[UNAGI_FRAMES_IN_FLIGHT_MAX];
+    /** When the frame has been sent (to report the server lag) */
+    ev_tstamp submit_times[UNAGI_FRAMES_IN_FLIGHT_MAX];
+    /** QueryFence issued before  reusing a Fence, to report whether
+        the server had to wait for the rendering of a previous frame */
+    xcb_sync_query_fence_cookie_t fence_cookies[UNAGI_FRAMES_IN_FLIGHT_MAX];
+    unsigned int head;
+    unsigned int len;
+    /** Ring of SYNC Fences triggered after each frame (fence mode) */
+    xcb_sync_fence_t fences[UNAGI_FRAMES_IN_FLIGHT_MAX];
+    /** Whether the Fence has been triggered and not reset yet */
+    bool fences_triggered[UNAGI_FRAMES_IN_FLIGHT_MAX];
+    /** Next Fence to be triggered */
+    unsigned int fence_n;
+  } frames;
+  /** Painting statistics, dumped on SIGUSR1 */
+  unagi_stats_t stats;
+  /** Dump statistics on exit as well */
+  bool stats_on_exit;
+  /** libev watcher on SIGUSR1 to dump statistics */
+  ev_signal event_stats_signal_watcher;
   /** EWMH-related information */
   xcb_ewmh_connection_t ewmh;
   /** The X extensions information */
   unagi_display_extensions_t extensions;
   /** The Window specific to the compositing manager */
   xcb_window_t cm_window;
+  /** Paint directly on the Composite overlay Window without any buffer */
+  bool paint_direct;
+  /** Present frames from a dedicated thread with its own connection */
+  bool paint_thread;
+  /** Maximum painting rate of windows which are not focused (Hz), 0
+      if they are painted at the full rate */
+  unsigned int background_rate;
+  /** Paint damage of the focused fullscreen window right away, without
+      waiting for the paint timer nor VBlank (tearing allowed) */
+  bool low_latency;
+  /** Whether the next frame is such an immediate one */
+  bool paint_immediate;
+  /** Never degrade painting quality when frames are over budget (see
+      unagi_governor_frame()) */
+  bool governor_disabled;
+  /** The Composite overlay Window when painting directly on it */
+  xcb_window_t overlay_window;
   /** The list of all windows as objects */
   unagi_window_t *windows;
   unagi_window_t *windows_tail;
+  /** Windows  whose  replies  are  still  awaited,  in  the  requests
+      order */
+  unagi_window_t *windows_pending;
+  unagi_window_t *windows_pending_tail;
+  /** Windows whose Damage object must be subtracted at the next frame
+      (see unagi_window_set_dirty()) */
+  unagi_window_t *windows_dirty;
+  /** Windows painted at each frame (already damaged), in stacking
+      order, only rebuilt when the stack or these windows change */
+  struct
+  {
+    unagi_window_t **windows;
+    unsigned int len;
+    unsigned int size;
+    bool is_outdated;
+  } windows_painted;
   /** Binary Trees used for lookups (The list is still useful for stack order) */
   unagi_util_itree_t *windows_itree;
   /** Damaged region which must be repainted */
   xcb_xfixes_region_t damaged;
+  /** Damaged rectangles not added to the damaged Region yet */
+  struct
+  {
+    xcb_rectangle_t *rectangles;
+    unsigned int len;
+    unsigned int size;
+  } damaged_rectangles;
+  /** Bounding box of the damaged area, only windows overlapping it are
+      painted (meaningless when the damaged Region is None) */
+  xcb_rectangle_t damaged_extents;
   bool force_repaint;
   /** List of KeySyms, only updated when receiving a KeyboardMapping event */
   xcb_key_symbols_t *keysyms;
@@ -93,6 +208,10 @@ typedef struct _unagi_conf_t
     xcb_get_property_cookie_t cookie;
     /** Specify whether this property has been set */
     bool initialised;
+    /** Open addressing hash set of the atoms above, to check whether an
+        atom is supported without scanning them (None is never stored) */
+    xcb_atom_t *set;
+    uint32_t set_mask;
   } atoms_supported;
 
   /** Path to the rendering backends directory */
@@ -106,6 +225,8 @@ typedef struct _unagi_conf_t
   char *plugins_dir;
   /** List of plugins enabled in the configuration file */
   unagi_plugin_t *plugins;
+  /** Plugins subscribed to each hook, rebuilt from the list above */
+  unagi_plugin_hooks_t plugins_hooks;
 
   /** Keyboard masks values meaningful on KeyPress/KeyRelease event */
   struct
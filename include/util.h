@@ -6,6 +6,7 @@
 
 #define mod(x, N) ((((x) < 0) ? (((x) % (N)) + (N)) : (x)) % (N))
 #define min(x, y) ((x) < (y) ? (x) : (y))
+#define max(x, y) ((x) > (y) ? (x) : (y))
 
 #define unagi_ssizeof(foo)            (ssize_t)sizeof(foo)
 #define unagi_countof(foo)            (unagi_ssizeof(foo) / unagi_ssizeof(foo[0]))
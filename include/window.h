@@ -7,11 +7,17 @@
 #include <xcb/xcb.h>
 #include <xcb/damage.h>
 #include <xcb/xfixes.h>
+#include <xcb/shape.h>
+#include <xcb/sync.h>
 
 #include "util.h"
 
 #define UNAGI_WINDOW_FULLY_DAMAGED_RATIO 0.9
 
+/** Delay before releasing the Damage object and Pixmap of an unmapped
+    window (seconds) */
+#define UNAGI_WINDOW_RELEASE_DELAY 10.0
+
 #define UNAGI_WINDOW_TRANSFORM_STATUS_NONE 0
 #define UNAGI_WINDOW_TRANSFORM_STATUS_REQUIRED 1
 #define UNAGI_WINDOW_TRANSFORM_STATUS_DONE 2
@@ -21,14 +27,80 @@ typedef struct _unagi_window_t
   xcb_window_t id;
   xcb_get_window_attributes_reply_t *attributes;
   xcb_get_geometry_reply_t *geometry;
+  /** Pending GetWindowAttributes and GetGeometry requests of a window
+      added from  an event,  whose  attributes and geometry  are  set
+      from the event until the replies are received without blocking
+      (see unagi_window_collect_pending()) */
+  xcb_get_window_attributes_cookie_t attributes_cookie;
+  xcb_get_geometry_cookie_t geometry_cookie;
+  /** GetWindowAttributes reply received before the GetGeometry one */
+  xcb_get_window_attributes_reply_t *pending_attributes;
+  bool is_pending;
+  struct _unagi_window_t *pending_next;
+  /** Screen-relative  Region, only  created when needed  at painting
+      time (see unagi_window_get_screen_region()) */
   xcb_xfixes_region_t region;
-  xcb_xfixes_fetch_region_cookie_t shape_cookie;
+  /** Whether the Region does not match the window geometry anymore */
+  bool is_region_outdated;
+  /** Pending GetRectangles request of the bounding shape */
+  xcb_shape_get_rectangles_cookie_t shape_cookie;
   bool is_rectangular;
+  /** Bounding shape rectangles, relative to the window origin (only
+      for non-rectangular windows) */
+  xcb_rectangle_t *shape_rectangles;
+  unsigned int shape_rectangles_len;
+  /** Incremented each time the shape changes */
+  unsigned int shape_serial;
   xcb_damage_damage_t damage;
   bool damaged;
   float damaged_ratio;
   short damage_notify_counter;
+  /** Whether the window is in the dirty list */
+  bool is_dirty;
+  struct _unagi_window_t *dirty_next;
+  /** Damage of a background window accumulated until it is painted,
+      screen-relative (see unagi_rate_defer_damage()) */
+  bool is_rate_deferred;
+  xcb_rectangle_t rate_deferred;
+  struct _unagi_window_t *rate_deferred_next;
+  /** When the damage of a background window has been painted last */
+  double rate_flush_time;
+  /** Window holding the client hints: the window itself, or the active
+      window it contains if reparented by the window manager */
+  xcb_window_t client_id;
+  /** Whether the client hints have to be read from the property cache */
+  bool is_client_pending;
+  struct _unagi_window_t *client_pending_next;
+  /** _NET_WM_BYPASS_COMPOSITOR value (1 to bypass the compositor when
+      fullscreen, 2 to never bypass it) */
+  uint32_t bypass;
+  /** _NET_WM_SYNC_REQUEST_COUNTER (the extended one if any), and the
+      Alarm reporting its changes, None if the client does not set it */
+  xcb_sync_counter_t sync_counter;
+  xcb_sync_alarm_t sync_alarm;
+  bool is_sync_extended;
+  /** Counter value of the last frame completed by the client, not
+      reported as drawn yet */
+  uint64_t sync_frame_value;
+  bool is_sync_frame_pending;
+  /** Whether the frame has been painted, and in which frame submitted
+      to the paint thread, reported once this one has been presented */
+  bool is_sync_frame_painted;
+  uint64_t sync_frame_present;
+  struct _unagi_window_t *sync_frame_next;
+  /** Whether the window has been resized but the client has not drawn
+      at the new size yet, its previous Pixmap being painted meanwhile */
+  bool is_resize_pending;
+  double resize_time;
+  struct _unagi_window_t *resize_next;
   xcb_pixmap_t pixmap;
+  /** Size (including border) of the window when its Pixmap was named,
+      only differing from the geometry while a resize is deferred */
+  uint16_t pixmap_width;
+  uint16_t pixmap_height;
+  /** When the window has been unmapped, to release its Damage object
+      and Pixmap later on */
+  double unmap_time;
   int transform_status;
   double transform_matrix[4][4];
   void *rendering;
@@ -37,6 +109,8 @@ typedef struct _unagi_window_t
 } unagi_window_t;
 
 void unagi_window_free_pixmap(unagi_window_t *);
+void unagi_window_create_damage(unagi_window_t *);
+bool unagi_window_release_unmapped(const double);
 void unagi_window_list_cleanup(void);
 
 /** Get the  window object  associated with the  given Window  XID. As
@@ -54,17 +128,26 @@ void unagi_window_register_notify(const unagi_window_t *);
 void unagi_window_get_root_background_pixmap(void);
 xcb_pixmap_t unagi_window_get_root_background_pixmap_finalise(void);
 xcb_pixmap_t unagi_window_new_root_background_pixmap(void);
-xcb_pixmap_t unagi_window_get_pixmap(const unagi_window_t *);
+xcb_pixmap_t unagi_window_get_pixmap(unagi_window_t *);
 bool unagi_window_is_rectangular(unagi_window_t *);
-xcb_xfixes_region_t unagi_window_get_region(unagi_window_t *, bool, bool);
+void unagi_window_check_shape(unagi_window_t *);
+void unagi_window_set_unshaped(unagi_window_t *);
+xcb_xfixes_region_t unagi_window_get_screen_region(unagi_window_t *);
+void unagi_window_add_damaged(const unagi_window_t *);
 bool unagi_window_is_visible(const unagi_window_t *);
+bool unagi_window_rectangle_covers_screen(const xcb_rectangle_t *);
+bool unagi_window_is_fullscreen(const unagi_window_t *);
 void unagi_window_get_invisible_window_pixmap(unagi_window_t *);
 void unagi_window_get_invisible_window_pixmap_finalise(unagi_window_t *);
 void unagi_window_manage_existing(const int nwindows, const xcb_window_t *);
-unagi_window_t *window_add(const xcb_window_t, bool);
+void unagi_window_manage_existing_finalise(void);
+unagi_window_t *window_add(const xcb_window_t, xcb_get_geometry_reply_t *,
+                           const uint8_t);
+void unagi_window_collect_pending(void);
 void unagi_window_map_raised(const unagi_window_t *);
 void unagi_window_restack(unagi_window_t *, xcb_window_t);
-void unagi_window_paint_all(unagi_window_t *);
+void unagi_window_set_dirty(unagi_window_t *);
+void unagi_window_paint_all(void);
 
 static inline float
 window_get_damaged_ratio(unagi_window_t *window, xcb_damage_notify_event_t *event)
@@ -84,3 +167,18 @@ window_get_damaged_ratio(unagi_window_t *window, xcb_damage_notify_event_t *even
 
 UNAGI_DO_GEOMETRY_WITH_BORDER(width)
 UNAGI_DO_GEOMETRY_WITH_BORDER(height)
+
+/** Get the  screen-relative rectangle of  a window including  its
+ *  border, which is also its Region for rectangular windows
+ *
+ * \param window The window object
+ * \param rectangle The rectangle to fill
+ */
+static inline void
+unagi_window_get_rectangle(const unagi_window_t *window, xcb_rectangle_t *rectangle)
+{
+  rectangle->x = window->geometry->x;
+  rectangle->y = window->geometry->y;
+  rectangle->width = window_width_with_border(window->geometry);
+  rectangle->height = window_height_with_border(window->geometry);
+}
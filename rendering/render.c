@@ -3,12 +3,18 @@
 
 #include <xcb/xcb.h>
 #include <xcb/render.h>
+#include <xcb/composite.h>
+#include <xcb/shape.h>
 #include <xcb/xcb_renderutil.h>
 
 #include "window.h"
 #include "structs.h"
 #include "plugin.h"
+#include "display.h"
 #include "util.h"
+#include "paint_thread.h"
+#include "governor.h"
+#include "protocol.h"
 
 #define _DOUBLE_TO_FIXED(f) ((xcb_render_fixed_t) ((f) * 65536))
 
@@ -30,15 +36,34 @@ typedef struct __render_alpha_picture_t
   struct __render_alpha_picture_t *previous;
 } _render_alpha_picture_t;
 
+/** Window painted during the current frame when painting directly on
+    the overlay Window */
+typedef struct
+{
+  /** The window object */
+  unagi_window_t *window;
+  /** Render operator */
+  uint8_t op;
+  /** Alpha Picture if any */
+  xcb_render_picture_t alpha_picture;
+  /** Clip Region of translucent windows (what is visible of them) */
+  xcb_xfixes_region_t clip;
+} _render_direct_window_t;
+
 /** Information related to Render */
 typedef struct
 {
   /** Extension information */
   const xcb_query_extension_reply_t *ext;
-  /** Picture associated with the root window */
+  /** Picture associated with the root window (or the overlay Window
+      when painting directly on it) */
   xcb_render_picture_t picture;
-  /** Buffer Picture used to paint the windows before the root Picture */
+  /** Buffer Picture used to paint the windows before the root Picture,
+      None when painting directly on the overlay Window */
   xcb_render_picture_t buffer_picture;
+  /** Buffer Pictures painted alternately when frames are presented by
+      the paint thread (buffer_picture is the current one) */
+  xcb_render_picture_t buffer_pictures[UNAGI_PAINT_THREAD_BUFFERS];
   /** Picture associated with the background Pixmap */
   xcb_render_picture_t background_picture;
   /** All Picture formats supported by the screen */
@@ -54,6 +79,14 @@ typedef struct
   unagi_plugin_t *opacity_plugin;
   /** Alpha pictures list */
   _render_alpha_picture_t *alpha_pictures;
+  /** Windows painted during the current frame, bottommost first, when
+      painting directly on the overlay Window */
+  struct
+  {
+    _render_direct_window_t *windows;
+    unsigned int len;
+    unsigned int size;
+  } direct;
 } _render_unagi_conf_t;
 
 static _render_unagi_conf_t _render_conf;
@@ -67,6 +100,14 @@ typedef struct
   bool is_argb;
   /** Pointer to global alpha picture */
   _render_alpha_picture_t *alpha_picture;
+  /** Whether the Picture is clipped to the window shape */
+  bool is_clipped;
+  /** Whether the clip must be set again (new Picture) */
+  bool is_clip_outdated;
+  /** Window shape serial the clip has been set for */
+  unsigned int shape_serial;
+  /** Whether the transformed Picture uses the "fast" filter */
+  bool is_filter_fast;
 } _render_unagi_window_t;
 
 /** Request label of Render extension for X error reporting, which are
@@ -281,15 +322,12 @@ _render_init_root_background(void)
     }
 }
 
-/** Create the  Picture associated  with the root  Window and  get its
- *  background as well
+/** Get the PictFormats  supported by the screen,  only done once as
+ *  they never change
  */
 static bool
-_render_init_root_picture(void)
+_render_init_pict_formats(void)
 {
-  /* Now  create the  root window  picture used  when  compositing but
-     before get the screen visuals... */
-
   assert(_render_pict_formats_cookie.sequence);
 
   /* The  "PictFormat" object  holds information  needed  to translate
@@ -322,6 +360,15 @@ _render_init_root_picture(void)
     xcb_render_util_find_standard_format(_render_conf.pict_formats,
                                          XCB_PICT_STANDARD_ARGB_32)->id;
 
+  return true;
+}
+
+/** Create the Picture associated with the root Window and the buffer
+ *  Picture, whose size depends on the root Window one
+ */
+static void
+_render_init_root_picture(void)
+{
   /* Create Picture associated with the root window */
   {
     _render_conf.picture = xcb_generate_id(globalconf.connection);
@@ -336,27 +383,91 @@ _render_init_root_picture(void)
   }
 
   /* Create a buffer Picture to  avoid image flickering when trying to
-     draw on the root window Picture directly */
-  {
-    xcb_pixmap_t pixmap = xcb_generate_id(globalconf.connection);
-    
-    xcb_create_pixmap(globalconf.connection, globalconf.screen->root_depth, pixmap,
-		      globalconf.screen->root, globalconf.screen->width_in_pixels,
-		      globalconf.screen->height_in_pixels);
+     draw on the root window Picture directly (one per frame presented
+     by the paint thread at the same time) */
+  const unsigned int buffers_len = globalconf.paint_thread ?
+    UNAGI_PAINT_THREAD_BUFFERS : 1;
 
-    _render_conf.buffer_picture = xcb_generate_id(globalconf.connection);
+  for(unsigned int n = 0; n < buffers_len; n++)
+    {
+      xcb_pixmap_t pixmap = xcb_generate_id(globalconf.connection);
 
-    xcb_render_create_picture(globalconf.connection,
-			      _render_conf.buffer_picture,
-			      pixmap,
-			      _render_conf.pictvisual->format,
-			      0, NULL);
+      xcb_create_pixmap(globalconf.connection, globalconf.screen->root_depth, pixmap,
+                        globalconf.screen->root, globalconf.screen->width_in_pixels,
+                        globalconf.screen->height_in_pixels);
 
-    xcb_free_pixmap(globalconf.connection, pixmap);
-  }
+      _render_conf.buffer_pictures[n] = xcb_generate_id(globalconf.connection);
 
-  /* Initialise the root background Picture */
-  _render_init_root_background();
+      xcb_render_create_picture(globalconf.connection,
+                                _render_conf.buffer_pictures[n],
+                                pixmap,
+                                _render_conf.pictvisual->format,
+                                0, NULL);
+
+      xcb_free_pixmap(globalconf.connection, pixmap);
+    }
+
+  _render_conf.buffer_picture = _render_conf.buffer_pictures[0];
+}
+
+/** Free the root and buffer Pictures */
+static void
+_render_free_root_picture(void)
+{
+  xcb_render_free_picture(globalconf.connection, _render_conf.picture);
+
+  for(unsigned int n = 0; n < UNAGI_PAINT_THREAD_BUFFERS; n++)
+    if(_render_conf.buffer_pictures[n])
+      {
+        xcb_render_free_picture(globalconf.connection,
+                                _render_conf.buffer_pictures[n]);
+
+        _render_conf.buffer_pictures[n] = XCB_NONE;
+      }
+
+  _render_conf.buffer_picture = XCB_NONE;
+}
+
+/** Get the Composite overlay Window, which is  painted directly when
+ *  there  is no buffer  Picture, and create its Picture.  Input events
+ *  go through it as its input shape is set to an empty Region
+ *
+ * \return True if the overlay Window is available
+ */
+static bool
+_render_init_overlay_picture(void)
+{
+  xcb_composite_get_overlay_window_reply_t *overlay_reply =
+    xcb_composite_get_overlay_window_reply(globalconf.connection,
+                                           xcb_composite_get_overlay_window_unchecked(globalconf.connection,
+                                                                                      globalconf.screen->root),
+                                           NULL);
+
+  if(!overlay_reply)
+    {
+      unagi_warn("Can't get the overlay Window, painting through a buffer");
+      return false;
+    }
+
+  globalconf.overlay_window = overlay_reply->overlay_win;
+  free(overlay_reply);
+
+  xcb_xfixes_region_t empty_region = xcb_generate_id(globalconf.connection);
+  xcb_xfixes_create_region(globalconf.connection, empty_region, 0, NULL);
+  xcb_xfixes_set_window_shape_region(globalconf.connection,
+                                     globalconf.overlay_window,
+                                     XCB_SHAPE_SK_INPUT, 0, 0, empty_region);
+
+  xcb_xfixes_destroy_region(globalconf.connection, empty_region);
+
+  _render_conf.picture = xcb_generate_id(globalconf.connection);
+  _render_conf.buffer_picture = XCB_NONE;
+
+  xcb_render_create_picture(globalconf.connection,
+                            _render_conf.picture,
+                            globalconf.overlay_window,
+                            _render_conf.pictvisual->format,
+                            0, NULL);
 
   return true;
 }
@@ -383,27 +494,161 @@ render_init_finalise(void)
 
   free(render_version_reply);
 
-  return _render_init_root_picture();
+  if(!_render_init_pict_formats())
+    return false;
+
+  if(globalconf.paint_direct && !_render_init_overlay_picture())
+    globalconf.paint_direct = false;
+
+  /* Now  create the  root window  picture used  when  compositing and
+     get its background as well */
+  if(!globalconf.paint_direct)
+    _render_init_root_picture();
+
+  _render_init_root_background();
+
+  return true;
+}
+
+/** Get the screen-relative rectangle of a window actually painted: while
+ *  its resize is deferred, the previous Pixmap is painted at its own
+ *  size, thus clipped to the smallest of both sizes
+ *
+ * \param window The window object
+ * \param rectangle The rectangle to fill
+ * \return True if it does not cover the whole window
+ */
+static bool
+_render_window_get_painted_rectangle(const unagi_window_t *window,
+                                     xcb_rectangle_t *rectangle)
+{
+  unagi_window_get_rectangle(window, rectangle);
+  if(!window->is_resize_pending)
+    return false;
+
+  const bool is_partial = (window->pixmap_width < rectangle->width ||
+                           window->pixmap_height < rectangle->height);
+
+  if(window->pixmap_width < rectangle->width)
+    rectangle->width = window->pixmap_width;
+
+  if(window->pixmap_height < rectangle->height)
+    rectangle->height = window->pixmap_height;
+
+  return is_partial;
 }
 
-/** Reset the background,  used in case the root  window is resized or
- *  the root background image has changed
+/** Subtract from a Region the part of a window actually painted, the
+ *  remaining part of a window grown while its resize is deferred not
+ *  hiding what is below it
+ *
+ * \param window The window object
+ * \param region The Region to subtract from
+ */
+static void
+_render_subtract_window_region(unagi_window_t *window,
+                               const xcb_xfixes_region_t region)
+{
+  xcb_rectangle_t rectangle;
+  if(!_render_window_get_painted_rectangle(window, &rectangle))
+    {
+      xcb_xfixes_subtract_region(globalconf.connection, region,
+                                 unagi_window_get_screen_region(window),
+                                 region);
+      return;
+    }
+
+  xcb_xfixes_region_t painted_region = xcb_generate_id(globalconf.connection);
+  xcb_xfixes_create_region(globalconf.connection, painted_region,
+                           1, &rectangle);
+
+  xcb_xfixes_intersect_region(globalconf.connection, painted_region,
+                              unagi_window_get_screen_region(window),
+                              painted_region);
+
+  xcb_xfixes_subtract_region(globalconf.connection, region, painted_region,
+                             region);
+
+  xcb_xfixes_destroy_region(globalconf.connection, painted_region);
+}
+
+/** Check whether the window  has been painted opaque on  the last frame,
+ *  thus completely hiding the background below it
+ *
+ * \param window The window object
+ * \return True if the window is opaque
+ */
+static bool
+_render_window_is_opaque(const unagi_window_t *window)
+{
+  const _render_unagi_window_t *render_window =
+    (const _render_unagi_window_t *) window->rendering;
+
+  return (window->damaged && render_window &&
+          render_window->picture != XCB_NONE &&
+          !render_window->is_argb && !render_window->alpha_picture);
+}
+
+/** Only damage the part  of the screen where the background is actually
+ *  visible, e.g. not covered by opaque windows
+ */
+static void
+_render_damage_background(void)
+{
+  const xcb_rectangle_t screen_rectangle = {
+    .x = 0, .y = 0, .width = globalconf.screen->width_in_pixels,
+    .height = globalconf.screen->height_in_pixels
+  };
+
+  xcb_xfixes_region_t background_region = xcb_generate_id(globalconf.connection);
+  xcb_xfixes_create_region(globalconf.connection, background_region,
+                           1, &screen_rectangle);
+
+  for(unagi_window_t *window = globalconf.windows; window; window = window->next)
+    if(unagi_window_is_visible(window) && _render_window_is_opaque(window))
+      _render_subtract_window_region(window, background_region);
+
+  unagi_display_add_damaged_region(&background_region, true);
+}
+
+/** Reset the background when the root background image has changed:
+ *  only the background  Picture is replaced and the  visible part of
+ *  the background repainted
  */
 static void
 render_reset_background(void)
 {
-  xcb_render_free_picture(globalconf.connection,
-			  _render_conf.background_picture);
+  const xcb_render_picture_t old_background_picture = _render_conf.background_picture;
 
   /* Send requests to get the root window background pixmap */
   unagi_window_get_root_background_pixmap();
+  _render_init_root_background();
 
-  /* Calling render_init_root_background() is not enough when the Root
-     Window is resized as the Root Picture must be recreated as well */
-  _render_pict_formats_cookie =
-    xcb_render_query_pict_formats_unchecked(globalconf.connection);
+  xcb_render_free_picture(globalconf.connection, old_background_picture);
+
+  _render_damage_background();
+}
+
+/** Reset the root and buffer Pictures when the root Window is resized,
+ *  the whole screen is then repainted by the caller
+ */
+static void
+render_reset_root(void)
+{
+  /* The overlay Window is resized along with the root Window */
+  if(!globalconf.paint_direct)
+    {
+      /* The paint thread may still be copying the buffers */
+      unagi_paint_thread_wait_idle();
 
-  _render_init_root_picture();
+      _render_free_root_picture();
+      _render_init_root_picture();
+    }
+
+  /* The background may have been resized as well */
+  xcb_render_free_picture(globalconf.connection, _render_conf.background_picture);
+  unagi_window_get_root_background_pixmap();
+  _render_init_root_background();
 }
 
 /** Create the alpha Picture associated  with a window by only filling
@@ -545,6 +790,18 @@ _render_get_window_alpha_picture(_render_unagi_window_t *render_window,
 static void
 render_paint_background(void)
 {
+  /* The background is painted last when painting directly */
+  if(globalconf.paint_direct)
+    {
+      _render_conf.direct.len = 0;
+      return;
+    }
+
+  /* Also extends the damaged Region to what this buffer missed */
+  if(globalconf.paint_thread)
+    _render_conf.buffer_picture =
+      _render_conf.buffer_pictures[unagi_paint_thread_acquire()];
+
   xcb_xfixes_set_picture_clip_region(globalconf.connection,
                                      _render_conf.buffer_picture,
                                      globalconf.damaged, 0, 0);
@@ -552,7 +809,90 @@ render_paint_background(void)
   _render_paint_root_background_to_buffer();
 }
 
-/** Paint the window to the buffer Picture
+/** Composite the window Picture to the given Picture
+ *
+ * \param window The window to be painted
+ * \param render_composite_op The Render operator
+ * \param alpha_picture The alpha Picture used as mask if any
+ * \param destination The destination Picture
+ */
+static inline void
+_render_composite_window(const unagi_window_t *window,
+                         const uint8_t render_composite_op,
+                         const xcb_render_picture_t alpha_picture,
+                         const xcb_render_picture_t destination)
+{
+  /* Not larger than the Pixmap, the remaining part of a grown window
+     is left to what is below it */
+  xcb_rectangle_t rectangle;
+  _render_window_get_painted_rectangle(window, &rectangle);
+
+  xcb_render_composite(globalconf.connection,
+		       render_composite_op,
+		       ((_render_unagi_window_t *) window->rendering)->picture,
+                       alpha_picture,
+                       destination,
+		       0, 0, 0, 0,
+		       rectangle.x, rectangle.y,
+		       rectangle.width, rectangle.height);
+}
+
+/** Record a window to be painted on the overlay Window at the end of
+ *  the frame, as the topmost windows have to be painted first
+ *
+ * \param window The window to be painted
+ * \param render_composite_op The Render operator
+ * \param alpha_picture The alpha Picture used as mask if any
+ */
+static void
+_render_direct_window_append(unagi_window_t *window,
+                             const uint8_t render_composite_op,
+                             const xcb_render_picture_t alpha_picture)
+{
+  if(_render_conf.direct.len == _render_conf.direct.size)
+    {
+      _render_conf.direct.size = _render_conf.direct.size ?
+        _render_conf.direct.size * 2 : 64;
+
+      _render_conf.direct.windows = realloc(_render_conf.direct.windows,
+                                            _render_conf.direct.size *
+                                            sizeof(_render_direct_window_t));
+    }
+
+  _render_direct_window_t *direct_window =
+    &_render_conf.direct.windows[_render_conf.direct.len++];
+
+  direct_window->window = window;
+  direct_window->op = render_composite_op;
+  direct_window->alpha_picture = alpha_picture;
+  direct_window->clip = XCB_NONE;
+}
+
+/** Set the filter of a transformed window Picture, "good" unless the
+ *  governor degraded it to "fast" as painting is over budget
+ *
+ * \param render_window The window Render information
+ */
+static void
+_render_set_window_filter(_render_unagi_window_t *render_window)
+{
+  render_window->is_filter_fast =
+    (unagi_governor_get_tier() >= UNAGI_GOVERNOR_TIER_FAST_FILTER);
+
+  if(render_window->is_filter_fast)
+    xcb_render_set_picture_filter(globalconf.connection,
+                                  render_window->picture,
+                                  sizeof("fast") - 1, "fast",
+                                  0, NULL);
+  else
+    xcb_render_set_picture_filter(globalconf.connection,
+                                  render_window->picture,
+                                  sizeof("good") - 1, "good",
+                                  0, NULL);
+}
+
+/** Paint the window to the buffer Picture (or record it to be painted
+ *  directly on the overlay Window)
  *
  * \param window The window to be painted
  */
@@ -591,6 +931,9 @@ render_paint_window(unagi_window_t *window)
 				window_pictvisual->format,
 				XCB_RENDER_CP_SUBWINDOW_MODE,
 				&create_picture_val);
+
+      render_window->is_clipped = false;
+      render_window->is_clip_outdated = true;
     }
 
   uint8_t render_composite_op = XCB_RENDER_PICT_OP_SRC;
@@ -603,25 +946,36 @@ render_paint_window(unagi_window_t *window)
         render_composite_op = XCB_RENDER_PICT_OP_OVER;
 
       /* For  non-rectangular  Windows, clip  the  Window  Picture to  its
-         shaped Region to paint  them properly (otherwise for applications
-         such  as  xeyes,  garbage  pixels are  shown  as  RenderComposite
-         expects a rectangular area)
-
-         \todo: Should ShapeNotify be handled as well?
-      */
-      if(!unagi_window_is_rectangular(window))
+         shape to paint  them properly (otherwise for applications such as
+         xeyes, garbage pixels are shown as RenderComposite expects a
+         rectangular area).  The clip is kept  by the Picture,  so it is
+         only set again when the shape changes */
+      if(!unagi_window_is_rectangular(window) &&
+         (render_window->is_clip_outdated ||
+          render_window->shape_serial != window->shape_serial))
         {
-          xcb_xfixes_region_t shape_region = unagi_window_get_region(window, false, false);
-
-          xcb_xfixes_set_picture_clip_region(globalconf.connection,
-                                             render_window->picture,
-                                             shape_region,
-                                             (int16_t) window->geometry->border_width,
-                                             (int16_t) window->geometry->border_width);
+          xcb_render_set_picture_clip_rectangles(globalconf.connection,
+                                                 render_window->picture,
+                                                 (int16_t) window->geometry->border_width,
+                                                 (int16_t) window->geometry->border_width,
+                                                 window->shape_rectangles_len,
+                                                 window->shape_rectangles);
+
+          render_window->is_clipped = true;
+        }
+      else if(unagi_window_is_rectangular(window) && render_window->is_clipped)
+        {
+          const uint32_t clip_mask_val = XCB_NONE;
+          xcb_render_change_picture(globalconf.connection,
+                                    render_window->picture,
+                                    XCB_RENDER_CP_CLIP_MASK,
+                                    &clip_mask_val);
 
-          xcb_xfixes_destroy_region(globalconf.connection, shape_region);
+          render_window->is_clipped = false;
         }
 
+      render_window->is_clip_outdated = false;
+      render_window->shape_serial = window->shape_serial;
       break;
 
     case UNAGI_WINDOW_TRANSFORM_STATUS_REQUIRED:
@@ -641,10 +995,7 @@ render_paint_window(unagi_window_t *window)
                                          render_window->picture,
                                          render_transform);
 
-        xcb_render_set_picture_filter(globalconf.connection,
-                                      render_window->picture,
-                                      sizeof("good"), "good",
-                                      0, NULL);
+        _render_set_window_filter(render_window);
       }
 
       window->transform_status = UNAGI_WINDOW_TRANSFORM_STATUS_DONE;
@@ -653,35 +1004,124 @@ render_paint_window(unagi_window_t *window)
     case UNAGI_WINDOW_TRANSFORM_STATUS_DONE:
       /* Once the transformation has been done, it is kept until
          FreePicture request is issued, so doing it again will result
-         in OOM... */
+         in OOM... but the filter follows the governor tier */
+      if(render_window->is_filter_fast !=
+         (unagi_governor_get_tier() >= UNAGI_GOVERNOR_TIER_FAST_FILTER))
+        _render_set_window_filter(render_window);
+
       break;
     }
 
+  /* Only the first plugin giving the opacity is relevant */
   xcb_render_picture_t alpha_picture = XCB_NONE;
-  for(unagi_plugin_t *plugin = globalconf.plugins; plugin; plugin = plugin->next)
-    if(plugin->enable && plugin->vtable->activated &&
-       plugin->vtable->window_get_opacity)
-      {
-        const uint16_t opacity = (*plugin->vtable->window_get_opacity)(window);
-        alpha_picture = _render_get_window_alpha_picture(render_window,
-                                                         opacity);
+  if(globalconf.plugins_hooks.window_get_opacity.len)
+    {
+      const unagi_plugin_vtable_t *vtable =
+        globalconf.plugins_hooks.window_get_opacity.vtables[0];
 
-        if(alpha_picture != XCB_NONE)
-          render_composite_op = XCB_RENDER_PICT_OP_OVER;
+      const uint16_t opacity = (*vtable->window_get_opacity)(window);
+      alpha_picture = _render_get_window_alpha_picture(render_window, opacity);
 
-        break;
-      }
+      if(alpha_picture != XCB_NONE)
+        render_composite_op = XCB_RENDER_PICT_OP_OVER;
+    }
 
-  xcb_render_composite(globalconf.connection,
-		       render_composite_op,
-		       render_window->picture,
-                       alpha_picture,
-                       _render_conf.buffer_picture,
-		       0, 0, 0, 0,
-		       window->geometry->x,
-		       window->geometry->y,
-		       window_width_with_border(window->geometry),
-		       window_height_with_border(window->geometry));
+  if(globalconf.paint_direct)
+    _render_direct_window_append(window, render_composite_op, alpha_picture);
+  else
+    _render_composite_window(window, render_composite_op, alpha_picture,
+                             _render_conf.buffer_picture);
+}
+
+/** Paint the windows  recorded during the frame directly on the overlay
+ *  Window without  any buffer. To avoid flickering, each pixel covered
+ *  by an  opaque window is painted only once: opaque windows are painted
+ *  from the topmost one,  each of them removing its  Region from the
+ *  area left to paint, then the background is painted in what remains.
+ *  Translucent windows are finally blended bottom-up, clipped to what
+ *  was left  visible of them, thus  only these areas are painted twice
+ */
+static void
+_render_paint_direct(void)
+{
+  xcb_xfixes_region_t remaining_region = xcb_generate_id(globalconf.connection);
+
+  if(globalconf.damaged)
+    {
+      xcb_xfixes_create_region(globalconf.connection, remaining_region, 0, NULL);
+      xcb_xfixes_copy_region(globalconf.connection, globalconf.damaged,
+                             remaining_region);
+    }
+  else
+    {
+      const xcb_rectangle_t screen_rectangle = {
+        .x = 0, .y = 0, .width = globalconf.screen->width_in_pixels,
+        .height = globalconf.screen->height_in_pixels
+      };
+
+      xcb_xfixes_create_region(globalconf.connection, remaining_region,
+                               1, &screen_rectangle);
+    }
+
+  for(unsigned int n = _render_conf.direct.len; n > 0; n--)
+    {
+      _render_direct_window_t *direct_window = &_render_conf.direct.windows[n - 1];
+
+      if(direct_window->op == XCB_RENDER_PICT_OP_SRC)
+        {
+          xcb_xfixes_set_picture_clip_region(globalconf.connection,
+                                             _render_conf.picture,
+                                             remaining_region, 0, 0);
+
+          _render_composite_window(direct_window->window, direct_window->op,
+                                   direct_window->alpha_picture,
+                                   _render_conf.picture);
+
+          /* The background is painted in the part of a grown window
+             not covered by its previous Pixmap */
+          _render_subtract_window_region(direct_window->window,
+                                         remaining_region);
+        }
+      else
+        {
+          direct_window->clip = xcb_generate_id(globalconf.connection);
+          xcb_xfixes_create_region(globalconf.connection, direct_window->clip,
+                                   0, NULL);
+          xcb_xfixes_copy_region(globalconf.connection, remaining_region,
+                                 direct_window->clip);
+        }
+    }
+
+  xcb_xfixes_set_picture_clip_region(globalconf.connection,
+                                     _render_conf.picture,
+                                     remaining_region, 0, 0);
+
+  xcb_render_composite(globalconf.connection, XCB_RENDER_PICT_OP_SRC,
+		       _render_conf.background_picture, XCB_NONE,
+		       _render_conf.picture, 0, 0, 0, 0, 0, 0,
+		       globalconf.screen->width_in_pixels,
+		       globalconf.screen->height_in_pixels);
+
+  xcb_xfixes_destroy_region(globalconf.connection, remaining_region);
+
+  for(unsigned int n = 0; n < _render_conf.direct.len; n++)
+    {
+      _render_direct_window_t *direct_window = &_render_conf.direct.windows[n];
+      if(!direct_window->clip)
+        continue;
+
+      xcb_xfixes_set_picture_clip_region(globalconf.connection,
+                                         _render_conf.picture,
+                                         direct_window->clip, 0, 0);
+
+      _render_composite_window(direct_window->window, direct_window->op,
+                               direct_window->alpha_picture,
+                               _render_conf.picture);
+
+      xcb_xfixes_destroy_region(globalconf.connection, direct_window->clip);
+    }
+
+  _render_conf.direct.len = 0;
 }
 
 /** Routine to  paint everything on  the root Picture, it  just paints
@@ -690,6 +1130,20 @@ render_paint_window(unagi_window_t *window)
 static void
 render_paint_all(void)
 {
+  if(globalconf.paint_direct)
+    {
+      _render_paint_direct();
+      return;
+    }
+
+  /* The paint thread copies the buffer to the root Picture */
+  if(globalconf.paint_thread)
+    {
+      unagi_paint_thread_submit(_render_conf.buffer_picture,
+                                _render_conf.picture);
+      return;
+    }
+
   /* This step  is necessary  (e.g. don't paint  directly on  the root
      window Picture in  the loop) to avoid flickering  which is really
      annoying */
@@ -782,8 +1236,13 @@ render_free(void)
 {
   free(_render_conf.pict_formats);
   xcb_render_free_picture(globalconf.connection, _render_conf.background_picture);
-  xcb_render_free_picture(globalconf.connection, _render_conf.picture);
-  xcb_render_free_picture(globalconf.connection, _render_conf.buffer_picture);
+  _render_free_root_picture();
+
+  if(globalconf.overlay_window)
+    xcb_composite_release_overlay_window(globalconf.connection,
+                                         globalconf.screen->root);
+
+  free(_render_conf.direct.windows);
 }
 
 /** Structure holding all the functions addresses */
@@ -791,6 +1250,7 @@ unagi_rendering_t rendering_functions = {
   render_init,
   render_init_finalise,
   render_reset_background,
+  render_reset_root,
   render_paint_background,
   render_paint_window,
   render_paint_all,
@@ -15,6 +15,9 @@
 xcb_atom_t UNAGI__NET_WM_WINDOW_OPACITY;
 xcb_atom_t UNAGI__XROOTPMAP_ID;
 xcb_atom_t UNAGI__XSETROOT_ID;
+xcb_atom_t UNAGI__NET_WM_BYPASS_COMPOSITOR;
+xcb_atom_t UNAGI__NET_WM_FRAME_DRAWN;
+xcb_atom_t UNAGI__NET_WM_FRAME_TIMINGS;
 
 /** Structure defined on purpose to be able to send all the InternAtom
     requests */
@@ -34,7 +37,10 @@ typedef struct {
 static atom_t atoms_list[] = {
   { &UNAGI__NET_WM_WINDOW_OPACITY, { 0 }, sizeof("_NET_WM_WINDOW_OPACITY") - 1, "_NET_WM_WINDOW_OPACITY" },
   { &UNAGI__XROOTPMAP_ID, { 0 }, sizeof("_XROOTPMAP_ID") - 1, "_XROOTPMAP_ID" },
-  { &UNAGI__XSETROOT_ID, { 0 }, sizeof("_XSETROOT_ID") - 1, "_XSETROOT_ID" }
+  { &UNAGI__XSETROOT_ID, { 0 }, sizeof("_XSETROOT_ID") - 1, "_XSETROOT_ID" },
+  { &UNAGI__NET_WM_BYPASS_COMPOSITOR, { 0 }, sizeof("_NET_WM_BYPASS_COMPOSITOR") - 1, "_NET_WM_BYPASS_COMPOSITOR" },
+  { &UNAGI__NET_WM_FRAME_DRAWN, { 0 }, sizeof("_NET_WM_FRAME_DRAWN") - 1, "_NET_WM_FRAME_DRAWN" },
+  { &UNAGI__NET_WM_FRAME_TIMINGS, { 0 }, sizeof("_NET_WM_FRAME_TIMINGS") - 1, "_NET_WM_FRAME_TIMINGS" }
 };
 
 static const ssize_t atoms_list_len = unagi_countof(atoms_list);
@@ -122,6 +128,56 @@ unagi_atoms_is_background_atom(const xcb_atom_t atom)
   return false;
 }
 
+/** \param atom The Atom
+ *  \return The first slot of this Atom in the _NET_SUPPORTED hash set
+ */
+static inline uint32_t
+_atoms_supported_hash(const xcb_atom_t atom)
+{
+  return (atom * 2654435761U) & globalconf.atoms_supported.set_mask;
+}
+
+/** Free the _NET_SUPPORTED value and its hash set */
+static void
+_atoms_supported_wipe(void)
+{
+  xcb_ewmh_get_atoms_reply_wipe(&globalconf.atoms_supported.value);
+  globalconf.atoms_supported.initialised = false;
+
+  free(globalconf.atoms_supported.set);
+  globalconf.atoms_supported.set = NULL;
+}
+
+/** Build the hash set of the _NET_SUPPORTED atoms, sized to at least
+ *  twice their number so that probe sequences stay short
+ */
+static void
+_atoms_supported_set_build(void)
+{
+  const uint32_t atoms_len = globalconf.atoms_supported.value.atoms_len;
+
+  uint32_t set_size = 16;
+  while(set_size < atoms_len * 2)
+    set_size *= 2;
+
+  globalconf.atoms_supported.set = calloc(set_size, sizeof(xcb_atom_t));
+  globalconf.atoms_supported.set_mask = set_size - 1;
+
+  for(uint32_t atom_n = 0; atom_n < atoms_len; atom_n++)
+    {
+      const xcb_atom_t atom = globalconf.atoms_supported.value.atoms[atom_n];
+      if(atom == XCB_NONE)
+        continue;
+
+      uint32_t slot = _atoms_supported_hash(atom);
+      while(globalconf.atoms_supported.set[slot] != XCB_NONE &&
+            globalconf.atoms_supported.set[slot] != atom)
+        slot = (slot + 1) & globalconf.atoms_supported.set_mask;
+
+      globalconf.atoms_supported.set[slot] = atom;
+    }
+}
+
 /** On  receiving a  X  PropertyNotify for  _NET_SUPPORTED, its  value
  *  should be updated accordingly
  *
@@ -132,8 +188,7 @@ unagi_atoms_update_supported(const xcb_property_notify_event_t *event)
 {
   if(globalconf.atoms_supported.initialised)
     {
-      xcb_ewmh_get_atoms_reply_wipe(&globalconf.atoms_supported.value);
-      globalconf.atoms_supported.initialised = false;
+      _atoms_supported_wipe();
       globalconf.atoms_supported.cookie.sequence = 0;
     }
 
@@ -158,10 +213,7 @@ unagi_atoms_is_supported(const xcb_atom_t atom)
     {
       /* Free existing value if needed */
       if(globalconf.atoms_supported.initialised)
-        {
-          globalconf.atoms_supported.initialised = false;
-          xcb_ewmh_get_atoms_reply_wipe(&globalconf.atoms_supported.value);
-        }
+        _atoms_supported_wipe();
 
       if(!xcb_ewmh_get_supported_reply(&globalconf.ewmh,
 				       globalconf.atoms_supported.cookie,
@@ -171,15 +223,28 @@ unagi_atoms_is_supported(const xcb_atom_t atom)
 
       globalconf.atoms_supported.cookie.sequence = 0;
       globalconf.atoms_supported.initialised = true;
+      _atoms_supported_set_build();
     }
-  else if(!globalconf.atoms_supported.initialised)
+  else if(!globalconf.atoms_supported.initialised || atom == XCB_NONE)
     return false;
 
-  for(uint32_t atom_n = 0;
-      atom_n < globalconf.atoms_supported.value.atoms_len;
-      atom_n++)
-    if(globalconf.atoms_supported.value.atoms[atom_n] == atom)
+  for(uint32_t slot = _atoms_supported_hash(atom);
+      globalconf.atoms_supported.set[slot] != XCB_NONE;
+      slot = (slot + 1) & globalconf.atoms_supported.set_mask)
+    if(globalconf.atoms_supported.set[slot] == atom)
       return true;
 
   return false;
 }
+
+/** Free the _NET_SUPPORTED value, if any */
+void
+unagi_atoms_cleanup(void)
+{
+  if(globalconf.atoms_supported.cookie.sequence)
+    xcb_discard_reply(globalconf.connection,
+                      globalconf.atoms_supported.cookie.sequence);
+
+  if(globalconf.atoms_supported.initialised)
+    _atoms_supported_wipe();
+}
@@ -0,0 +1,761 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include <xcb/xcb.h>
+#include <xcb/composite.h>
+#include <xcb/xfixes.h>
+#include <xcb/sync.h>
+
+#include "client.h"
+#include "structs.h"
+#include "atoms.h"
+#include "display.h"
+#include "property.h"
+#include "paint_thread.h"
+#include "util.h"
+#include "protocol.h"
+
+/** Client hints affecting compositing:
+ *
+ *  - _NET_WM_BYPASS_COMPOSITOR: when the topmost window is fullscreen
+ *    and requests it, all the windows are unredirected, thus shown
+ *    directly by the X server, and painting is suspended meanwhile.
+ *
+ *  - _NET_WM_FRAME_DRAWN and _NET_WM_FRAME_TIMINGS: clients setting an
+ *    extended _NET_WM_SYNC_REQUEST_COUNTER increment it to an odd value
+ *    when starting to draw a frame, and to an even value once done.
+ *    Changes are reported by a SYNC Alarm, and once the frame has been
+ *    painted (and presented by the paint thread if any), the client is
+ *    told so it can draw the next one.
+ *
+ *  - Resize synchronisation: when a window setting any of these counters
+ *    is resized, its previous Pixmap is painted until the client has
+ *    drawn at the new size (it updates the counter on a _NET_WM_SYNC_REQUEST
+ *    from the window manager, or completes a frame), rather than naming
+ *    a Pixmap with unfinished content and painting it again right after.
+ *    This is bounded by UNAGI_CLIENT_RESIZE_TIMEOUT for unresponsive
+ *    clients.
+ *
+ *  Hints are read on the top-level window, or on the active window it
+ *  contains if reparented by the window manager (see rate.c).
+ */
+static struct
+{
+  /** Windows whose hints replies are still awaited */
+  unagi_window_t *pending;
+  /** Whether all windows are unredirected for the topmost one */
+  bool is_unredirected;
+  double unredirect_time;
+  /** Empty Region to hide the overlay Window while unredirected */
+  xcb_xfixes_region_t empty_region;
+  /** Windows whose completed frame must be reported as drawn */
+  unagi_window_t *frames;
+  /** Resized windows waiting for their client to draw */
+  unagi_window_t *resizes;
+} _client;
+
+/** Prefetch the client hints of a window, which are read from the
+ *  property cache before painting
+ *
+ * \param window The window object
+ */
+static void
+_client_get_hints(unagi_window_t *window)
+{
+  const xcb_atom_t atoms[] = {
+    UNAGI__NET_WM_BYPASS_COMPOSITOR,
+    globalconf.ewmh._NET_WM_SYNC_REQUEST_COUNTER
+  };
+
+  /* Frames cannot be synced without SYNC */
+  unagi_property_prefetch(window->client_id,
+                          globalconf.extensions.sync ? 2 : 1, atoms);
+
+  if(!window->is_client_pending)
+    {
+      window->is_client_pending = true;
+      window->client_pending_next = _client.pending;
+      _client.pending = window;
+    }
+}
+
+/** Remove a window from the list of windows whose hints replies are
+ *  still awaited
+ *
+ * \param window The window object
+ */
+static void
+_client_pending_remove(unagi_window_t *window)
+{
+  for(unagi_window_t **w = &_client.pending; *w; w = &(*w)->client_pending_next)
+    if(*w == window)
+      {
+        *w = window->client_pending_next;
+        break;
+      }
+
+  window->client_pending_next = NULL;
+  window->is_client_pending = false;
+}
+
+/** Forget about the completed frame of a window */
+static void
+_client_frame_remove(unagi_window_t *window)
+{
+  if(!window->is_sync_frame_pending)
+    return;
+
+  for(unagi_window_t **w = &_client.frames; *w; w = &(*w)->sync_frame_next)
+    if(*w == window)
+      {
+        *w = window->sync_frame_next;
+        break;
+      }
+
+  window->sync_frame_next = NULL;
+  window->is_sync_frame_pending = false;
+  window->is_sync_frame_painted = false;
+}
+
+/** Remove a window from the list of resized windows
+ *
+ * \param window The window object
+ */
+static void
+_client_resize_remove(unagi_window_t *window)
+{
+  for(unagi_window_t **w = &_client.resizes; *w; w = &(*w)->resize_next)
+    if(*w == window)
+      {
+        *w = window->resize_next;
+        break;
+      }
+
+  window->resize_next = NULL;
+  window->is_resize_pending = false;
+}
+
+/** Name the Pixmap of a resized window, once its client has drawn at
+ *  the new size or it took too long, and paint it entirely
+ *
+ * \param window The window object
+ */
+static void
+_client_resize_apply(unagi_window_t *window)
+{
+  _client_resize_remove(window);
+
+  unagi_window_free_pixmap(window);
+
+  /* Otherwise, named again once visible */
+  if(!unagi_window_is_visible(window))
+    return;
+
+  window->pixmap = unagi_window_get_pixmap(window);
+
+  /* The damage reported meanwhile has not been subtracted */
+  unagi_window_add_damaged(window);
+  window->damaged_ratio = 1.0;
+  unagi_window_set_dirty(window);
+}
+
+/** Set the sync counter of a window, and create an Alarm triggered each
+ *  time its value increases
+ *
+ * \param window The window object
+ * \param counter The counter, None if frames are not synced
+ */
+static void
+_client_set_sync_counter(unagi_window_t *window, const xcb_sync_counter_t counter)
+{
+  if(counter == window->sync_counter)
+    return;
+
+  if(window->sync_alarm != XCB_NONE)
+    {
+      xcb_sync_destroy_alarm(globalconf.connection, window->sync_alarm);
+      window->sync_alarm = XCB_NONE;
+    }
+
+  _client_frame_remove(window);
+  window->sync_counter = counter;
+
+  /* It would not be reported anymore */
+  if(window->is_resize_pending)
+    _client_resize_apply(window);
+
+  if(counter == XCB_NONE)
+    return;
+
+  unagi_debug("Window %jx syncs %s with counter %jx", (uintmax_t) window->id,
+              window->is_sync_extended ? "its frames" : "resizes",
+              (uintmax_t) counter);
+
+  window->sync_alarm = xcb_generate_id(globalconf.connection);
+
+  /* Relative to the current value, rearmed for the next increment */
+  const uint32_t alarm_values[] = {
+    counter,
+    XCB_SYNC_VALUETYPE_RELATIVE,
+    0, 1,
+    XCB_SYNC_TESTTYPE_POSITIVE_COMPARISON,
+    0, 1,
+    true
+  };
+
+  xcb_sync_create_alarm(globalconf.connection, window->sync_alarm,
+                        XCB_SYNC_CA_COUNTER | XCB_SYNC_CA_VALUE_TYPE |
+                        XCB_SYNC_CA_VALUE | XCB_SYNC_CA_TEST_TYPE |
+                        XCB_SYNC_CA_DELTA | XCB_SYNC_CA_EVENTS,
+                        alarm_values);
+}
+
+/** Get the hints replies of a window, without blocking
+ *
+ * \param window The window object
+ * \return true if all the replies have been received
+ */
+static bool
+_client_collect_window(unagi_window_t *window)
+{
+  const xcb_get_property_reply_t *bypass_reply;
+  if(!unagi_property_poll(window->client_id, UNAGI__NET_WM_BYPASS_COMPOSITOR,
+                          &bypass_reply))
+    return false;
+
+  const xcb_get_property_reply_t *counter_reply = NULL;
+  if(globalconf.extensions.sync &&
+     !unagi_property_poll(window->client_id,
+                          globalconf.ewmh._NET_WM_SYNC_REQUEST_COUNTER,
+                          &counter_reply))
+    return false;
+
+  window->bypass = 0;
+  if(bypass_reply && bypass_reply->type == XCB_ATOM_CARDINAL &&
+     bypass_reply->format == 32 && xcb_get_property_value_length(bypass_reply))
+    window->bypass = *((uint32_t *) xcb_get_property_value(bypass_reply));
+
+  /* The extended counter is preferred, as the basic one is only updated
+     on _NET_WM_SYNC_REQUEST from the window manager */
+  xcb_sync_counter_t counter = XCB_NONE;
+  int values_len = 0;
+  if(counter_reply && counter_reply->type == XCB_ATOM_CARDINAL &&
+     counter_reply->format == 32)
+    values_len = xcb_get_property_value_length(counter_reply) / (int) sizeof(uint32_t);
+
+  if(values_len)
+    counter = ((uint32_t *) xcb_get_property_value(counter_reply))[values_len > 1];
+
+  if(counter != window->sync_counter)
+    window->is_sync_extended = (values_len > 1);
+
+  _client_set_sync_counter(window, counter);
+  return true;
+}
+
+/** Start reading the client hints of a window, once it is mapped for
+ *  the first time
+ *
+ * \param window The window object
+ */
+void
+unagi_client_manage(unagi_window_t *window)
+{
+  if(window->client_id == XCB_NONE)
+    window->client_id = window->id;
+
+  _client_get_hints(window);
+}
+
+/** Once the top-level window containing the active window is known, read
+ *  the hints on the active window itself if it has been reparented
+ *
+ * \param window_id The top-level Window XID
+ * \param client_id The active Window XID
+ */
+void
+unagi_client_set_active(const xcb_window_t window_id, const xcb_window_t client_id)
+{
+  unagi_window_t *window = unagi_window_list_get(window_id);
+  if(!window || client_id == XCB_NONE || window->client_id == client_id)
+    return;
+
+  /* Hints of the previous active window it contained are not updated */
+  if(window->client_id != XCB_NONE && window->client_id != window->id)
+    unagi_property_window_remove(window->client_id);
+
+  window->client_id = client_id;
+
+  /* To get PropertyNotify of the hints on the client window too */
+  const uint32_t select_input_val = XCB_EVENT_MASK_PROPERTY_CHANGE;
+  xcb_change_window_attributes(globalconf.connection, client_id,
+                               XCB_CW_EVENT_MASK, &select_input_val);
+
+  _client_get_hints(window);
+}
+
+/** On receiving a PropertyNotify for any client hint, read it again
+ *  once fetched again by the property cache
+ *
+ * \param event The X PropertyNotify event
+ */
+void
+unagi_client_property_notify(const xcb_property_notify_event_t *event)
+{
+  if(event->atom != UNAGI__NET_WM_BYPASS_COMPOSITOR &&
+     event->atom != globalconf.ewmh._NET_WM_SYNC_REQUEST_COUNTER)
+    return;
+
+  /* This is rare enough to look for the client window in the list */
+  for(unagi_window_t *window = globalconf.windows; window; window = window->next)
+    if(window->client_id == event->window)
+      {
+        _client_get_hints(window);
+
+        /* The bypass state is only updated when painting */
+        if(event->atom == UNAGI__NET_WM_BYPASS_COMPOSITOR &&
+           unagi_window_is_visible(window))
+          unagi_window_add_damaged(window);
+
+        break;
+      }
+}
+
+/** Handler for SYNC AlarmNotify events, reported each time the counter
+ *  of a window increases
+ *
+ * \param event The X SYNC AlarmNotify event
+ */
+void
+unagi_client_alarm_notify(const xcb_sync_alarm_notify_event_t *event)
+{
+  unagi_window_t *window;
+  for(window = globalconf.windows; window; window = window->next)
+    if(window->sync_alarm == event->alarm)
+      break;
+
+  if(!window)
+    return;
+
+  /* The counter has been destroyed with the client window */
+  if(event->state == XCB_SYNC_ALARMSTATE_DESTROYED)
+    {
+      window->sync_alarm = XCB_NONE;
+      window->sync_counter = XCB_NONE;
+      _client_frame_remove(window);
+
+      if(window->is_resize_pending)
+        _client_resize_apply(window);
+
+      return;
+    }
+
+  const uint64_t value = ((uint64_t) (uint32_t) event->counter_value.hi << 32) |
+    event->counter_value.lo;
+
+  /* Odd values of the extended counter are set while drawing the frame */
+  if(window->is_sync_extended && value % 2)
+    return;
+
+  /* The client has drawn at its new size */
+  if(window->is_resize_pending)
+    {
+      globalconf.stats.resizes_synced++;
+      _client_resize_apply(window);
+    }
+
+  if(!window->is_sync_extended)
+    return;
+
+  window->sync_frame_value = value;
+
+  /* Superseding the frame previously completed, if not reported yet */
+  window->is_sync_frame_painted = false;
+
+  if(!window->is_sync_frame_pending)
+    {
+      window->is_sync_frame_pending = true;
+      window->sync_frame_next = _client.frames;
+      _client.frames = window;
+    }
+}
+
+/** Keep painting the previous Pixmap of a resized window until its
+ *  client has drawn at the new size, provided that the client updates a
+ *  sync counter and the window has already been painted
+ *
+ * \param window The window object
+ * \return true if the new Pixmap must not be named yet
+ */
+bool
+unagi_client_defer_resize(unagi_window_t *window)
+{
+  if(window->sync_alarm == XCB_NONE || window->pixmap == XCB_NONE ||
+     _client.is_unredirected)
+    return false;
+
+  /* Already waiting, still bounded by the first resize for interactive
+     resizes */
+  if(window->is_resize_pending)
+    return true;
+
+  window->is_resize_pending = true;
+  window->resize_time = ev_now(globalconf.event_loop);
+  window->resize_next = _client.resizes;
+  _client.resizes = window;
+
+  globalconf.stats.resizes_deferred++;
+  return true;
+}
+
+/** Name the Pixmap of resized windows whose client has not drawn within
+ *  UNAGI_CLIENT_RESIZE_TIMEOUT, called before painting
+ *
+ * \param now The current time
+ */
+void
+unagi_client_resize_flush(const double now)
+{
+  unagi_window_t *window = _client.resizes;
+  while(window)
+    {
+      unagi_window_t *next = window->resize_next;
+
+      if(now - window->resize_time >= UNAGI_CLIENT_RESIZE_TIMEOUT)
+        {
+          unagi_debug("Window %jx not drawn after resize", (uintmax_t) window->id);
+          _client_resize_apply(window);
+        }
+
+      window = next;
+    }
+}
+
+/** \return When the paint timer must fire for resized windows whose
+ *          client may not draw, or 0 if there is none
+ */
+double
+unagi_client_next_resize_time(void)
+{
+  double next_time = 0;
+
+  for(unagi_window_t *window = _client.resizes; window; window = window->resize_next)
+    if(!next_time || window->resize_time < next_time)
+      next_time = window->resize_time;
+
+  return next_time ? next_time + UNAGI_CLIENT_RESIZE_TIMEOUT : 0;
+}
+
+/** Collect the hints replies received since the last painting */
+void
+unagi_client_collect(void)
+{
+  unagi_window_t **w = &_client.pending;
+  while(*w)
+    {
+      unagi_window_t *window = *w;
+
+      if(!_client_collect_window(window))
+        {
+          w = &window->client_pending_next;
+          continue;
+        }
+
+      *w = window->client_pending_next;
+      window->client_pending_next = NULL;
+      window->is_client_pending = false;
+    }
+}
+
+/** Redirect the windows again, their Pixmaps are not valid anymore */
+static void
+_client_redirect(void)
+{
+  xcb_composite_redirect_subwindows(globalconf.connection,
+                                    globalconf.screen->root,
+                                    XCB_COMPOSITE_REDIRECT_MANUAL);
+
+  if(globalconf.overlay_window != XCB_NONE)
+    xcb_xfixes_set_window_shape_region(globalconf.connection,
+                                       globalconf.overlay_window,
+                                       XCB_SHAPE_SK_BOUNDING, 0, 0, XCB_NONE);
+
+  /* Their Pixmap is named again below anyway */
+  while(_client.resizes)
+    {
+      unagi_window_t *window = _client.resizes;
+      _client.resizes = window->resize_next;
+      window->resize_next = NULL;
+      window->is_resize_pending = false;
+    }
+
+  for(unagi_window_t *window = globalconf.windows; window; window = window->next)
+    {
+      unagi_window_free_pixmap(window);
+
+      if(unagi_window_is_visible(window))
+        window->pixmap = unagi_window_get_pixmap(window);
+    }
+
+  globalconf.force_repaint = true;
+}
+
+/** Unredirect all the windows, so that the topmost one is shown by the
+ *  X server without being composited
+ */
+static void
+_client_unredirect(void)
+{
+  xcb_composite_unredirect_subwindows(globalconf.connection,
+                                      globalconf.screen->root,
+                                      XCB_COMPOSITE_REDIRECT_MANUAL);
+
+  /* The overlay Window would hide the windows otherwise */
+  if(globalconf.overlay_window != XCB_NONE)
+    {
+      if(_client.empty_region == XCB_NONE)
+        {
+          _client.empty_region = xcb_generate_id(globalconf.connection);
+          xcb_xfixes_create_region(globalconf.connection, _client.empty_region,
+                                   0, NULL);
+        }
+
+      xcb_xfixes_set_window_shape_region(globalconf.connection,
+                                         globalconf.overlay_window,
+                                         XCB_SHAPE_SK_BOUNDING, 0, 0,
+                                         _client.empty_region);
+    }
+
+  /* Painted again once redirected */
+  unagi_display_reset_damaged();
+}
+
+/** Unredirect all windows when the topmost one is fullscreen and asks
+ *  for bypassing the compositor, or redirect them again otherwise,
+ *  called before painting
+ *
+ * \return true if windows are unredirected, thus painting is suspended
+ */
+bool
+unagi_client_update_bypass(void)
+{
+  const unagi_window_t *topmost = NULL;
+  for(unagi_window_t *window = globalconf.windows_tail; window; window = window->prev)
+    if(unagi_window_is_visible(window))
+      {
+        topmost = window;
+        break;
+      }
+
+  const bool is_unredirected = topmost && topmost->bypass == 1 &&
+    unagi_window_is_fullscreen(topmost);
+
+  if(is_unredirected != _client.is_unredirected)
+    {
+      const double now = ev_time();
+
+      if(is_unredirected)
+        {
+          unagi_debug("Window %jx bypasses the compositor",
+                      (uintmax_t) topmost->id);
+
+          _client_unredirect();
+          globalconf.stats.bypass_unredirections++;
+          _client.unredirect_time = now;
+        }
+      else
+        {
+          unagi_debug("Compositing all windows again");
+
+          _client_redirect();
+          unagi_client_stats_update(now);
+        }
+
+      _client.is_unredirected = is_unredirected;
+    }
+  /* Nothing is painted meanwhile */
+  else if(is_unredirected)
+    unagi_display_reset_damaged();
+
+  return is_unredirected;
+}
+
+/** Account the time spent with all windows unredirected
+ *
+ * \param now The current time
+ */
+void
+unagi_client_stats_update(const double now)
+{
+  if(!_client.is_unredirected)
+    return;
+
+  globalconf.stats.bypass_time += now - _client.unredirect_time;
+  _client.unredirect_time = now;
+}
+
+/** \return true if all windows are unredirected */
+bool
+unagi_client_is_unredirected(void)
+{
+  return _client.is_unredirected;
+}
+
+/** \return true if a completed frame has to be reported as drawn, thus
+ *          painting is needed
+ */
+bool
+unagi_client_is_frame_pending(void)
+{
+  /* The deferred damage is painted on the next flush of the window, and
+     the painted frames are reported once presented */
+  for(const unagi_window_t *window = _client.frames; window;
+      window = window->sync_frame_next)
+    if(!window->is_rate_deferred && !window->is_sync_frame_painted)
+      return true;
+
+  return false;
+}
+
+/** Send a _NET_WM_FRAME_DRAWN or _NET_WM_FRAME_TIMINGS ClientMessage
+ *
+ * \param window The window object
+ * \param type The message type Atom
+ * \param data The data following the counter value
+ */
+static void
+_client_send_frame_message(const unagi_window_t *window, const xcb_atom_t type,
+                           const uint32_t data[3])
+{
+  xcb_client_message_event_t event;
+  memset(&event, 0, sizeof(event));
+  event.response_type = XCB_CLIENT_MESSAGE;
+  event.format = 32;
+  event.window = window->client_id;
+  event.type = type;
+  event.data.data32[0] = (uint32_t) window->sync_frame_value;
+  event.data.data32[1] = (uint32_t) (window->sync_frame_value >> 32);
+  memcpy(&event.data.data32[2], data, 3 * sizeof(uint32_t));
+
+  xcb_send_event(globalconf.connection, false, window->client_id,
+                 XCB_EVENT_MASK_NO_EVENT, (const char *) &event);
+}
+
+/** Tell the clients  whose completed frame has been painted  (or shown
+ *  directly when unredirected)  that they can draw the next one.  The
+ *  presentation time is not known, thus reported as such in the frame
+ *  timings
+ *
+ * \param is_painting Whether the windows not deferred have just been
+ *        painted, otherwise only the presented ones are reported
+ */
+static void
+_client_frames_report(const bool is_painting)
+{
+  if(!_client.frames)
+    return;
+
+  /* Clients use the monotonic clock */
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  const uint64_t drawn_time = (uint64_t) ts.tv_sec * 1000000 +
+    (uint64_t) ts.tv_nsec / 1000;
+
+  const uint32_t drawn_data[3] = {
+    (uint32_t) drawn_time, (uint32_t) (drawn_time >> 32), 0
+  };
+
+  const uint32_t timings_data[3] = {
+    0, (uint32_t) (globalconf.refresh_rate_interval * 1000000), 0
+  };
+
+  const uint64_t presented = globalconf.paint_thread ?
+    unagi_paint_thread_presented() : 0;
+
+  unagi_window_t **w = &_client.frames;
+  while(*w)
+    {
+      unagi_window_t *window = *w;
+
+      /* Unless its damage has been deferred (background windows rate
+         or governor), thus not painted yet */
+      if(is_painting && !window->is_rate_deferred &&
+         !window->is_sync_frame_painted)
+        {
+          window->is_sync_frame_painted = true;
+          if(globalconf.paint_thread)
+            window->sync_frame_present = unagi_paint_thread_submitted();
+        }
+
+      /* With the paint thread, not until the frame has been presented */
+      if(!window->is_sync_frame_painted ||
+         (globalconf.paint_thread && window->sync_frame_present > presented))
+        {
+          w = &window->sync_frame_next;
+          continue;
+        }
+
+      *w = window->sync_frame_next;
+      window->sync_frame_next = NULL;
+      window->is_sync_frame_pending = false;
+      window->is_sync_frame_painted = false;
+
+      _client_send_frame_message(window, UNAGI__NET_WM_FRAME_DRAWN, drawn_data);
+      _client_send_frame_message(window, UNAGI__NET_WM_FRAME_TIMINGS, timings_data);
+
+      globalconf.stats.frames_drawn_reported++;
+    }
+
+  xcb_flush(globalconf.connection);
+}
+
+/** Report the frames painted  as drawn, or once presented by the paint
+ *  thread, called after painting
+ */
+void
+unagi_client_frames_drawn(void)
+{
+  _client_frames_report(true);
+}
+
+/** Report the frames painted in the frames presented meanwhile by the
+ *  paint thread
+ */
+void
+unagi_client_frames_presented(void)
+{
+  _client_frames_report(false);
+}
+
+/** Free the client hints resources of a window being freed
+ *
+ * \param window The window object
+ */
+void
+unagi_client_window_free(unagi_window_t *window)
+{
+  if(window->is_client_pending)
+    _client_pending_remove(window);
+
+  /* The ones of the window itself are freed along with it */
+  if(window->client_id != XCB_NONE && window->client_id != window->id)
+    unagi_property_window_remove(window->client_id);
+
+  _client_frame_remove(window);
+
+  if(window->is_resize_pending)
+    _client_resize_remove(window);
+
+  if(window->sync_alarm != XCB_NONE)
+    xcb_sync_destroy_alarm(globalconf.connection, window->sync_alarm);
+}
+
+/** Free the resources allocated for the client hints */
+void
+unagi_client_cleanup(void)
+{
+  if(_client.empty_region != XCB_NONE)
+    xcb_xfixes_destroy_region(globalconf.connection, _client.empty_region);
+}
@@ -14,6 +14,9 @@
 #include <xcb/xfixes.h>
 #include <xcb/damage.h>
 #include <xcb/randr.h>
+#include <xcb/sync.h>
+#include <xcb/shape.h>
+#include <xcb/dpms.h>
 #include <xcb/xcb_ewmh.h>
 #include <xcb/xcb_aux.h>
 
@@ -21,8 +24,10 @@
 #include "display.h"
 #include "atoms.h"
 #include "window.h"
+#include "output.h"
 #include "util.h"
 #include "config.h"
+#include "protocol.h"
 
 /** Structure   holding   cookies   for   QueryVersion   requests   of
     extensions */
@@ -35,6 +40,12 @@ typedef struct {
   xcb_composite_query_version_cookie_t composite;
   /** RandR QueryVersion request cookie */
   xcb_randr_query_version_cookie_t randr;
+  /** SYNC Initialize request cookie */
+  xcb_sync_initialize_cookie_t sync;
+  /** Shape QueryVersion request cookie */
+  xcb_shape_query_version_cookie_t shape;
+  /** DPMS GetVersion request cookie */
+  xcb_dpms_get_version_cookie_t dpms;
 }  init_extensions_cookies_t;
 
 /** NOTICE:  All above  variables are  not thread-safe,  but  well, we
@@ -43,7 +54,7 @@ typedef struct {
 /** Initialise the  QueryVersion extensions cookies with  a 0 sequence
     number, this  is not thread-safe but  we don't care here  as it is
     only used during initialisation */
-static init_extensions_cookies_t _init_extensions_cookies = {{0}, {0}, {0}, {0}};
+static init_extensions_cookies_t _init_extensions_cookies = {{0}, {0}, {0}, {0}, {0}, {0}, {0}};
 
 /** Cookie request used when acquiring ownership on _NET_WM_CM_Sn */
 static xcb_get_selection_owner_cookie_t _get_wm_cm_owner_cookie = { 0 };
@@ -65,11 +76,17 @@ void unagi_display_init_extensions(void) {
     xcb_prefetch_extension_data(globalconf.connection, &xcb_damage_id);
     xcb_prefetch_extension_data(globalconf.connection, &xcb_xfixes_id);
     xcb_prefetch_extension_data(globalconf.connection, &xcb_randr_id);
+    xcb_prefetch_extension_data(globalconf.connection, &xcb_sync_id);
+    xcb_prefetch_extension_data(globalconf.connection, &xcb_shape_id);
+    xcb_prefetch_extension_data(globalconf.connection, &xcb_dpms_id);
 
     globalconf.extensions.composite = xcb_get_extension_data(globalconf.connection, &xcb_composite_id);
     globalconf.extensions.xfixes = xcb_get_extension_data(globalconf.connection, &xcb_xfixes_id);
     globalconf.extensions.damage = xcb_get_extension_data(globalconf.connection, &xcb_damage_id);
     globalconf.extensions.randr = xcb_get_extension_data(globalconf.connection, &xcb_randr_id);
+    globalconf.extensions.sync = xcb_get_extension_data(globalconf.connection, &xcb_sync_id);
+    globalconf.extensions.shape = xcb_get_extension_data(globalconf.connection, &xcb_shape_id);
+    globalconf.extensions.dpms = xcb_get_extension_data(globalconf.connection, &xcb_dpms_id);
 
     if(!globalconf.extensions.composite || !globalconf.extensions.composite->present)
         unagi_fatal("No Composite extension");
@@ -88,6 +105,24 @@ void unagi_display_init_extensions(void) {
         _init_extensions_cookies.randr = xcb_randr_query_version_unchecked(globalconf.connection, XCB_RANDR_MAJOR_VERSION, XCB_RANDR_MINOR_VERSION);
     else
         globalconf.extensions.randr = NULL;
+
+    /* SYNC is only needed to track frames with Fences */
+    if(globalconf.extensions.sync && globalconf.extensions.sync->present)
+        _init_extensions_cookies.sync = xcb_sync_initialize_unchecked(globalconf.connection, XCB_SYNC_MAJOR_VERSION, XCB_SYNC_MINOR_VERSION);
+    else
+        globalconf.extensions.sync = NULL;
+
+    /* Without Shape, windows can not be shaped anyway */
+    if(globalconf.extensions.shape && globalconf.extensions.shape->present)
+        _init_extensions_cookies.shape = xcb_shape_query_version_unchecked(globalconf.connection);
+    else
+        globalconf.extensions.shape = NULL;
+
+    /* Without DPMS, outputs are only known to be off from RandR */
+    if(globalconf.extensions.dpms && globalconf.extensions.dpms->present)
+        _init_extensions_cookies.dpms = xcb_dpms_get_version_unchecked(globalconf.connection, XCB_DPMS_MAJOR_VERSION, XCB_DPMS_MINOR_VERSION);
+    else
+        globalconf.extensions.dpms = NULL;
 }
 
 /** Get the  replies of the QueryVersion requests  previously sent and
@@ -112,6 +147,15 @@ unagi_display_init_extensions_finalise(void)
       unagi_fatal("Need Composite extension 0.2 at least");
     }
 
+  /* Need the overlay Window introduced in version >= 0.3 */
+  if(globalconf.paint_direct && composite_version_reply->minor_version < 3)
+    {
+      unagi_warn("Need Composite extension 0.3 to paint directly, painting "
+                 "through a buffer");
+
+      globalconf.paint_direct = false;
+    }
+
   free(composite_version_reply);
 
   assert(_init_extensions_cookies.damage.sequence);
@@ -155,9 +199,62 @@ unagi_display_init_extensions_finalise(void)
       if(!randr_version_reply || randr_version_reply->major_version < 1 ||
          randr_version_reply->minor_version < 1)
         globalconf.extensions.randr = NULL;
+      /* CRTC changes are reported since version 1.2 */
+      else
+        globalconf.extensions.randr_crtc_notify =
+          randr_version_reply->major_version > 1 ||
+          randr_version_reply->minor_version >= 2;
 
       free(randr_version_reply);
     }
+
+  /* Need Fences support introduced in version >= 3.1 */
+  if(globalconf.extensions.sync)
+    {
+      assert(_init_extensions_cookies.sync.sequence);
+
+      xcb_sync_initialize_reply_t *sync_version_reply =
+        xcb_sync_initialize_reply(globalconf.connection,
+                                  _init_extensions_cookies.sync,
+                                  NULL);
+
+      if(!sync_version_reply || sync_version_reply->major_version < 3 ||
+         (sync_version_reply->major_version == 3 &&
+          sync_version_reply->minor_version < 1))
+        globalconf.extensions.sync = NULL;
+
+      free(sync_version_reply);
+    }
+
+  if(globalconf.extensions.shape)
+    {
+      assert(_init_extensions_cookies.shape.sequence);
+
+      xcb_shape_query_version_reply_t *shape_version_reply =
+        xcb_shape_query_version_reply(globalconf.connection,
+                                      _init_extensions_cookies.shape,
+                                      NULL);
+
+      if(!shape_version_reply)
+        globalconf.extensions.shape = NULL;
+
+      free(shape_version_reply);
+    }
+
+  if(globalconf.extensions.dpms)
+    {
+      assert(_init_extensions_cookies.dpms.sequence);
+
+      xcb_dpms_get_version_reply_t *dpms_version_reply =
+        xcb_dpms_get_version_reply(globalconf.connection,
+                                   _init_extensions_cookies.dpms,
+                                   NULL);
+
+      if(!dpms_version_reply)
+        globalconf.extensions.dpms = NULL;
+
+      free(dpms_version_reply);
+    }
 }
 
 /** Handler for  PropertyNotify event meaningful to  set the timestamp
@@ -270,7 +367,10 @@ unagi_display_init_redirect(void)
 }
 
 /** Finish  redirection by  adding  all the  existing  windows in  the
- *  hierarchy
+ *  hierarchy. As the QueryTree reply follows the redirection, any error
+ *  of the latter has also been received once this returns
+ *
+ * \see unagi_window_manage_existing_finalise
  */
 void
 unagi_display_init_redirect_finalise(void)
@@ -292,6 +392,38 @@ unagi_display_init_redirect_finalise(void)
   free(query_tree_reply);
 }
 
+/** Extend the  bounding box  of the damaged area,  which  is  kept
+ *  client-side to only paint the windows overlapping it
+ *
+ * \param rectangle The damaged rectangle
+ */
+void
+unagi_display_add_damaged_extents(const xcb_rectangle_t *rectangle)
+{
+  xcb_rectangle_t *extents = &globalconf.damaged_extents;
+
+  if(!rectangle->width || !rectangle->height)
+    return;
+
+  if(!extents->width || !extents->height)
+    {
+      *extents = *rectangle;
+      return;
+    }
+
+  const int32_t x1 = min(extents->x, rectangle->x);
+  const int32_t y1 = min(extents->y, rectangle->y);
+  const int32_t x2 = max(extents->x + extents->width,
+                         rectangle->x + rectangle->width);
+  const int32_t y2 = max(extents->y + extents->height,
+                         rectangle->y + rectangle->height);
+
+  extents->x = (int16_t) x1;
+  extents->y = (int16_t) y1;
+  extents->width = (uint16_t) (x2 - x1);
+  extents->height = (uint16_t) (y2 - y1);
+}
+
 /** Add the given Region to the damaged Region by either copying it if
  *  the global Damaged is currently empty or adding it otherwise
  *
@@ -301,9 +433,9 @@ unagi_display_init_redirect_finalise(void)
  *
  * \param region Damaged Region to be added to the global one
  */
-void
-unagi_display_add_damaged_region(xcb_xfixes_region_t *region,
-                                 bool do_destroy_region)
+static void
+display_add_damaged_region(xcb_xfixes_region_t *region,
+                           bool do_destroy_region)
 {
   if(!*region)
     return;
@@ -341,6 +473,80 @@ unagi_display_add_damaged_region(xcb_xfixes_region_t *region,
     *region = XCB_NONE;
 }
 
+/** Add  the given Region  to  the damaged  Region,  its  extents  being
+ *  unknown client-side, consider the whole screen has been damaged
+ *
+ * \param region Damaged Region to be added to the global one
+ */
+void
+unagi_display_add_damaged_region(xcb_xfixes_region_t *region,
+                                 bool do_destroy_region)
+{
+  if(!*region)
+    return;
+
+  const xcb_rectangle_t screen_rectangle = {
+    .x = 0, .y = 0, .width = globalconf.screen->width_in_pixels,
+    .height = globalconf.screen->height_in_pixels
+  };
+
+  unagi_display_add_damaged_extents(&screen_rectangle);
+  display_add_damaged_region(region, do_destroy_region);
+}
+
+/** Maximum number of damaged rectangles kept before being sent */
+#define DISPLAY_DAMAGED_RECTANGLES_MAX 1024
+
+/** Add the given  screen-relative rectangle to the damaged area. This
+ *  does not send any request: rectangles are only sent, all at once,
+ *  when painting (see unagi_display_flush_damaged())
+ *
+ * \param rectangle The damaged rectangle
+ */
+void
+unagi_display_add_damaged_rectangle(const xcb_rectangle_t *rectangle)
+{
+  if(!rectangle->width || !rectangle->height)
+    return;
+
+  /* Bound the CreateRegion request size */
+  if(globalconf.damaged_rectangles.len == DISPLAY_DAMAGED_RECTANGLES_MAX)
+    unagi_display_flush_damaged();
+
+  if(globalconf.damaged_rectangles.len == globalconf.damaged_rectangles.size)
+    {
+      globalconf.damaged_rectangles.size = globalconf.damaged_rectangles.size ?
+        globalconf.damaged_rectangles.size * 2 : 64;
+
+      globalconf.damaged_rectangles.rectangles =
+        realloc(globalconf.damaged_rectangles.rectangles,
+                globalconf.damaged_rectangles.size * sizeof(xcb_rectangle_t));
+    }
+
+  globalconf.damaged_rectangles.rectangles[globalconf.damaged_rectangles.len++] =
+    *rectangle;
+
+  unagi_display_add_damaged_extents(rectangle);
+}
+
+/** Add  the damaged  rectangles  to the  damaged  Region with a  single
+ *  CreateRegion request, called before painting
+ */
+void
+unagi_display_flush_damaged(void)
+{
+  if(!globalconf.damaged_rectangles.len)
+    return;
+
+  xcb_xfixes_region_t region = xcb_generate_id(globalconf.connection);
+  xcb_xfixes_create_region(globalconf.connection, region,
+                           globalconf.damaged_rectangles.len,
+                           globalconf.damaged_rectangles.rectangles);
+
+  globalconf.damaged_rectangles.len = 0;
+  display_add_damaged_region(&region, true);
+}
+
 /** Destroy the global  damaged Region and set it  to None, meaningful
  *  at  each  re-painting iteration  to  check  whether  a repaint  is
  *  necessary. This region is filled in event handlers
@@ -353,6 +559,9 @@ unagi_display_reset_damaged(void)
       xcb_xfixes_destroy_region(globalconf.connection, globalconf.damaged);
       globalconf.damaged = XCB_NONE;
     }
+
+  globalconf.damaged_rectangles.len = 0;
+  globalconf.damaged_extents.width = globalconf.damaged_extents.height = 0;
 }
 
 /** Update screen information provided by RandR, currently only screen
@@ -369,6 +578,8 @@ unagi_display_update_screen_information(xcb_randr_get_screen_info_cookie_t scree
   if(!screen_info_cookie.sequence || !screen_resources_cookie.sequence)
     goto randr_not_available;
 
+  unagi_output_crtcs_reset();
+
   xcb_randr_get_screen_info_reply_t *screen_info_reply =
     xcb_randr_get_screen_info_reply(globalconf.connection, screen_info_cookie, NULL);
 
@@ -414,6 +625,12 @@ unagi_display_update_screen_information(xcb_randr_get_screen_info_cookie_t scree
                                                           crtc_info_cookie,
                                                           NULL);
 
+          if(crtc_info_reply)
+            unagi_output_crtc_update(crtcs[i], crtc_info_reply->mode,
+                                     crtc_info_reply->x, crtc_info_reply->y,
+                                     crtc_info_reply->width,
+                                     crtc_info_reply->height);
+
           if(crtc_info_reply && crtc_info_reply->mode != XCB_NONE)
             {
               globalconf.crtc[i] = crtc_info_reply;
@@ -436,6 +653,8 @@ unagi_display_update_screen_information(xcb_randr_get_screen_info_cookie_t scree
       free(screen_resources_reply);
     }
 
+  unagi_output_update();
+
  randr_not_available:
   if(!globalconf.refresh_rate_interval)
     {
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include <xcb/xcb.h>
 #include <xcb/composite.h>
@@ -10,6 +11,12 @@
 #include "window.h"
 #include "atoms.h"
 #include "key.h"
+#include "output.h"
+#include "rate.h"
+#include "governor.h"
+#include "client.h"
+#include "property.h"
+#include "protocol.h"
 
 /** Requests label of Composite extension for X error reporting, which
  *  are uniquely  identified according to their  minor opcode starting
@@ -135,6 +142,32 @@ error_get_request_label(const uint8_t request_major_code,
  */
 static void
 event_handle_error(xcb_generic_error_t *error)
+{
+  /* DamageCreate is not checked when adding a window which may have
+     been destroyed in the meantime, DestroyNotify will follow */
+  if(error->major_code == globalconf.extensions.damage->major_opcode &&
+     error->minor_code == XCB_DAMAGE_CREATE)
+    {
+      unagi_debug("DamageCreate failed for window %jx",
+                  (uintmax_t) error->resource_id);
+
+      unagi_window_t *window = unagi_window_list_get(error->resource_id);
+      if(window)
+        window->damage = XCB_NONE;
+
+      return;
+    }
+
+  unagi_event_log_error(error);
+}
+
+/** Log an X error with the labels of its request and error code, also
+ *  used for the errors of the paint thread connection
+ *
+ * \param error The X error
+ */
+void
+unagi_event_log_error(const xcb_generic_error_t *error)
 {
   /* To determine  whether the error comes from  an extension request,
      it use the 'first_error'  field of QueryExtension reply, plus the
@@ -222,16 +255,42 @@ event_handle_damage_notify(xcb_damage_notify_event_t *event)
 
   UNAGI_PLUGINS_EVENT_HANDLE(event, damage, window);
 
-  xcb_xfixes_region_t damaged_region;
-  bool is_temporary_region = false;
+  /* Windows are shown directly by the X server, and everything will be
+     painted once redirected again.  Likewise, resized windows are only
+     painted again once their client has drawn at the new size */
+  if(unagi_client_is_unredirected() || window->is_resize_pending)
+    return;
+
+  /* Background windows are only painted at a lower rate, their Damage
+     object is not subtracted meanwhile */
+  if(window->damaged)
+    {
+      const xcb_rectangle_t area = {
+        .x = (int16_t) (event->area.x + event->geometry.x),
+        .y = (int16_t) (event->area.y + event->geometry.y),
+        .width = event->area.width,
+        .height = event->area.height
+      };
+
+      if(unagi_rate_defer_damage(window, &area))
+        return;
+    }
+
+  /* Painted right away rather than on the next paint timer slot */
+  if(globalconf.low_latency && unagi_rate_is_active_fullscreen(window))
+    globalconf.paint_immediate = true;
+
+  /* Its Damage object must be subtracted at the next frame */
+  unagi_window_set_dirty(window);
 
   /* If the Window has never been  damaged, then it means it has never
      be painted on the screen yet, thus paint its entire content */
   if(!window->damaged)
     {
-      damaged_region = window->region;
+      unagi_window_add_damaged(window);
       window->damaged = true;
       window->damaged_ratio = 1.0;
+      globalconf.windows_painted.is_outdated = true;
     }
   /* Do nothing if the window is already fully damaged */
   else if(window->damaged_ratio >= UNAGI_WINDOW_FULLY_DAMAGED_RATIO)
@@ -240,31 +299,77 @@ event_handle_damage_notify(xcb_damage_notify_event_t *event)
     }
   /* If  the   window  is  considered   fully  damaged  or   too  many
      DamageNotify  events   have  been   received,  then   repaint  it
-     completely */
-  else if(window->damage_notify_counter++ > DAMAGE_NOTIFY_MAX ||
+     completely, as well as when painting is over budget (further events
+     are then ignored until the next frame) */
+  else if(unagi_governor_get_tier() >= UNAGI_GOVERNOR_TIER_BOUNDING_DAMAGE ||
+          window->damage_notify_counter++ > DAMAGE_NOTIFY_MAX ||
           window_get_damaged_ratio(window, event) >= UNAGI_WINDOW_FULLY_DAMAGED_RATIO)
     {
       /* @todo:  Perhaps  xcb_damage_add()  could  be  used  to  avoid
          further events to  be sent as the window  is considered fully
          damaged? */
-      damaged_region = window->region;
+      unagi_window_add_damaged(window);
       window->damaged_ratio = 1.0;
     }
-  /* Otherwise, just paint the damaged Region (which may be the entire
+  /* Otherwise, just paint the damaged area (which may be the entire
      Window or part of it */
   else
     {
-      damaged_region = xcb_generate_id(globalconf.connection);
-
       event->area.x += event->geometry.x;
       event->area.y += event->geometry.y;
-      xcb_xfixes_create_region(globalconf.connection, damaged_region,
-                               1, &event->area);
-
-      is_temporary_region = true;
+      unagi_display_add_damaged_rectangle(&event->area);
     }
+}
+
+/** Handler for SYNC AlarmNotify events reported when a client syncing
+ *  its frames updates its counter
+ *
+ * \param event The X SYNC AlarmNotify event
+ */
+static void
+event_handle_sync_alarm_notify(xcb_sync_alarm_notify_event_t *event)
+{
+  unagi_debug("SyncAlarmNotify: alarm=%jx, state=%ju",
+              (uintmax_t) event->alarm, (uintmax_t) event->state);
 
-  unagi_display_add_damaged_region(&damaged_region, is_temporary_region);
+  unagi_client_alarm_notify(event);
+}
+
+/** Handler for ShapeNotify events reported when the shape of a window
+ *  changes, only the bounding shape matters for painting
+ *
+ * \param event The X ShapeNotify event
+ */
+static void
+event_handle_shape_notify(xcb_shape_notify_event_t *event)
+{
+  if(event->shape_kind != XCB_SHAPE_SK_BOUNDING)
+    return;
+
+  unagi_window_t *window = unagi_window_list_get(event->affected_window);
+  if(!window)
+    return;
+
+  unagi_debug("ShapeNotify: window=%jx, shaped=%d",
+              (uintmax_t) event->affected_window, event->shaped);
+
+  /* The bounding shape is always within the window area */
+  if(unagi_window_is_visible(window))
+    unagi_window_add_damaged(window);
+
+  if(event->shaped)
+    unagi_window_check_shape(window);
+  else
+    {
+      /* A previous GetRectangles reply would be outdated */
+      if(window->shape_cookie.sequence)
+        {
+          xcb_discard_reply(globalconf.connection, window->shape_cookie.sequence);
+          window->shape_cookie.sequence = 0;
+        }
+
+      unagi_window_set_unshaped(window);
+    }
 }
 
 /** Handler for RRScreenChangeNotify events reported when the screen
@@ -285,6 +390,29 @@ event_handle_randr_screen_change_notify(xcb_randr_screen_change_notify_event_t *
   UNAGI_PLUGINS_EVENT_HANDLE(event, randr_screen_change_notify, NULL);
 }
 
+/** Handler for RRNotify events, only CRTC changes are selected to stop
+ *  painting outputs which have been disabled
+ *
+ * \param event The X RRNotify event
+ */
+static void
+event_handle_randr_notify(xcb_randr_notify_event_t *event)
+{
+  if(event->subCode != XCB_RANDR_NOTIFY_CRTC_CHANGE)
+    return;
+
+  const xcb_randr_crtc_change_t *crtc_change = &event->u.cc;
+
+  unagi_debug("RRCrtcChangeNotify: crtc=%ju, mode=%ju",
+              (uintmax_t) crtc_change->crtc, (uintmax_t) crtc_change->mode);
+
+  unagi_output_crtc_update(crtc_change->crtc, crtc_change->mode,
+                           crtc_change->x, crtc_change->y,
+                           crtc_change->width, crtc_change->height);
+
+  unagi_output_update();
+}
+
 /** Handler for KeyPress events reported once a key is pressed. Only
  *  handle when GrabKeyBoard has been issued beforehand.
  *
@@ -379,15 +507,20 @@ event_handle_circulate_notify(xcb_circulate_notify_event_t *event)
 static void
 event_handle_configure_notify(xcb_configure_notify_event_t *event)
 {
-  /* If  this is  the root  window, then  just create  again  the root
-     background picture */
+  /* If  this is  the root  window and it has been resized, then just
+     create again the root  Pictures, and repaint the whole screen */
   if(event->window == globalconf.screen->root)
     {
-      globalconf.screen->width_in_pixels = event->width;
-      globalconf.screen->height_in_pixels = event->height;
+      if(globalconf.screen->width_in_pixels != event->width ||
+         globalconf.screen->height_in_pixels != event->height)
+        {
+          globalconf.screen->width_in_pixels = event->width;
+          globalconf.screen->height_in_pixels = event->height;
 
-      globalconf.background_reset = true;
-      (*globalconf.rendering->reset_background)();
+          globalconf.background_reset = true;
+          globalconf.force_repaint = true;
+          (*globalconf.rendering->reset_root)();
+        }
 
       return;
     }
@@ -399,58 +532,77 @@ event_handle_configure_notify(xcb_configure_notify_event_t *event)
       return;
     }
 
-  /* Add the Window  Region to the damaged region  to clear old window
-     position or size and re-create the Window Region as well
-
-     @todo: Perhaps further checks  could be done to avoid re-creating
-            the Window Region but would it really change anything from
-            a performance POV?
-  */
-  bool is_not_visible = false;
+  /* Damage the window area to clear old window position or size, the
+     Window Region  itself is only updated if needed  when painting, so
+     moving or resizing windows does not send any XFixes request */
   if(unagi_window_is_visible(window))
     {
-      unagi_display_add_damaged_region(&window->region, true);
+      unagi_window_add_damaged(window);
       window->damaged_ratio = 1.0;
+      unagi_window_set_dirty(window);
+    }
+
+  /* Newer than the GetGeometry reply of a window being added */
+  if(window->geometry_cookie.sequence)
+    {
+      xcb_discard_reply(globalconf.connection, window->geometry_cookie.sequence);
+      window->geometry_cookie.sequence = 0;
     }
-  else
-    is_not_visible = true;
 
   window->geometry->x = event->x;
   window->geometry->y = event->y;
 
   bool update_pixmap = false;
+  const bool is_resized = (window->geometry->width != event->width ||
+                           window->geometry->height != event->height ||
+                           window->geometry->border_width != event->border_width);
 
   /* Invalidate  Pixmap and  Picture if  the window  has  been resized
      because  a  new  pixmap  is  allocated everytime  the  window  is
-     resized (only meaningful when the window is viewable) */
-  if(window->attributes->map_state == XCB_MAP_STATE_VIEWABLE &&
-     (window->geometry->width != event->width ||
-      window->geometry->height != event->height ||
-      window->geometry->border_width != event->border_width))
+     resized (only meaningful when the window is viewable).  Moving the
+     window, even off-screen, keeps the same Pixmap */
+  if(window->attributes->map_state == XCB_MAP_STATE_VIEWABLE && is_resized)
     update_pixmap = true;
 
   window->geometry->width = event->width;
   window->geometry->height = event->height;
   window->geometry->border_width = event->border_width;
   window->attributes->override_redirect = event->override_redirect;
+  window->is_region_outdated = true;
+
+  /* The shape is clipped to the window size */
+  if(is_resized && (!window->is_rectangular || window->shape_cookie.sequence))
+    unagi_window_check_shape(window);
+
+  /* The  Pixmap  of the  previous size  is useless,  it is only named
+     again when the window is moved back on the screen */
+  if(update_pixmap && !unagi_window_is_visible(window))
+    unagi_window_free_pixmap(window);
 
   if(unagi_window_is_visible(window))
     {
-      window->region = unagi_window_get_region(window, true, false);
+      /* Keep painting the previous Pixmap until the client has drawn
+         at the new size */
+      if(update_pixmap && unagi_client_defer_resize(window))
+        update_pixmap = false;
 
       /* This is needed to ensure that a window that was mapped
          outside the screen, and moved inside after, will be shown. An
          example is the gnome panel */
-      if(update_pixmap || is_not_visible)
+      if(update_pixmap || window->pixmap == XCB_NONE)
         {
           unagi_window_free_pixmap(window);
           window->pixmap = unagi_window_get_pixmap(window);
+
+          /* Mapped outside the screen until now */
+          unagi_window_create_damage(window);
         }
 
       /* Whatever happens (restack/resizing/moving Windows), this
          should be added to damaged area... */
-      unagi_display_add_damaged_region(&window->region, false);
+      unagi_window_add_damaged(window);
       window->damaged_ratio = 1.0;
+      unagi_window_set_dirty(window);
     }
 
   unagi_window_restack(window, event->above_sibling);
@@ -468,23 +620,28 @@ event_handle_configure_notify(xcb_configure_notify_event_t *event)
 static void
 event_handle_create_notify(xcb_create_notify_event_t *event)
 {
-  /* Add  the  new window  whose  identifier  is  given in  the  event
-     itself and  */
-  unagi_window_t *new_window = window_add(event->window, false);
-  if(!new_window)
-    {
-      unagi_debug("Cannot create window %jx", (uintmax_t) event->window);
-      return;
-    }
+  /* The overlay Window is painted, not composited */
+  if(event->window == globalconf.overlay_window)
+    return;
+
+  /* A window may be reported twice if it was created while managing
+     existing windows */
+  if(unagi_window_list_get(event->window))
+    return;
 
   /* No need  to do  a GetGeometry request  as the window  geometry is
      given in the CreateNotify event itself */
-  new_window->geometry = calloc(1, sizeof(xcb_get_geometry_reply_t));
-  new_window->geometry->x = event->x;
-  new_window->geometry->y = event->y;
-  new_window->geometry->width = event->width;
-  new_window->geometry->height = event->height;
-  new_window->geometry->border_width = event->border_width;
+  xcb_get_geometry_reply_t *geometry = calloc(1, sizeof(xcb_get_geometry_reply_t));
+  geometry->x = event->x;
+  geometry->y = event->y;
+  geometry->width = event->width;
+  geometry->height = event->height;
+  geometry->border_width = event->border_width;
+
+  /* Add  the  new window  whose  identifier  is  given in  the  event
+     itself, its attributes are received later on */
+  unagi_window_t *new_window = window_add(event->window, geometry,
+                                          event->override_redirect);
 
   UNAGI_PLUGINS_EVENT_HANDLE(event, create, new_window);
 }
@@ -532,21 +689,23 @@ event_handle_map_notify(xcb_map_notify_event_t *event)
     }
 
   window->attributes->map_state = XCB_MAP_STATE_VIEWABLE;
+  window->damaged = false;
+  globalconf.windows_painted.is_outdated = true;
+
+  /* Get notified of its properties changes, and prefetch the ones
+     needed to paint it */
+  unagi_window_register_notify(window);
+  unagi_property_manage(window);
 
   if(unagi_window_is_visible(window))
     {
-      /* Create and store the region associated with the window to
-         avoid creating regions all the time, this Region will be
-         destroyed only upon DestroyNotify or re-created upon
-         ConfigureNotify */
-      window->region = unagi_window_get_region(window, true, true);
-
       /* Everytime a window is mapped, a new pixmap is created */
       unagi_window_free_pixmap(window);
       window->pixmap = unagi_window_get_pixmap(window);
-    }
 
-  window->damaged = false;
+      /* Only on the first map or once released */
+      unagi_window_create_damage(window);
+    }
 
   UNAGI_PLUGINS_EVENT_HANDLE(event, map, window);
 }
@@ -563,15 +722,25 @@ event_handle_reparent_notify(xcb_reparent_notify_event_t *event)
 {
   unagi_window_t *window = unagi_window_list_get(event->window);
 
-  /* Add the window if it is not already managed */ 
-  if(event->parent == globalconf.screen->root ||
-     !unagi_window_list_get(event->window))
-    window_add(event->window, true);
-  /* Don't manage the window if the parent is not the root window */
-  else
-    unagi_window_list_remove_window(window, true);
+  /* Add the window if it is not already managed, its size is received
+     later on */
+  if(event->parent == globalconf.screen->root)
+    {
+      if(!window)
+        {
+          window = window_add(event->window, NULL, event->override_redirect);
+          window->geometry->x = event->x;
+          window->geometry->y = event->y;
+        }
 
-  UNAGI_PLUGINS_EVENT_HANDLE(event, reparent, window);
+      UNAGI_PLUGINS_EVENT_HANDLE(event, reparent, window);
+    }
+  /* Don't manage the window if the parent is not the root window */
+  else if(window)
+    {
+      UNAGI_PLUGINS_EVENT_HANDLE(event, reparent, window);
+      unagi_window_list_remove_window(window, true);
+    }
 }
 
 /** Handler for UnmapNotify event  reported when a UnmapWindow request
@@ -594,15 +763,22 @@ event_handle_unmap_notify(xcb_unmap_notify_event_t *event)
 
   if(unagi_window_is_visible(window))
     {
-      unagi_display_add_damaged_region(&window->region, true);
+      unagi_window_add_damaged(window);
       window->damaged_ratio = 1.0;
+      unagi_window_set_dirty(window);
     }
 
   /* Update window state */
   window->attributes->map_state = XCB_MAP_STATE_UNMAPPED;
 
+  /* Its Damage object and Pixmap are released if it stays unmapped */
+  window->unmap_time = ev_now(globalconf.event_loop);
+  if(!ev_is_active(&globalconf.event_release_timer_watcher))
+    ev_timer_again(globalconf.event_loop, &globalconf.event_release_timer_watcher);
+
   /* The window is not damaged anymore as it is not visible */
   window->damaged = false;
+  globalconf.windows_painted.is_outdated = true;
 
   UNAGI_PLUGINS_EVENT_HANDLE(event, unmap, window);
 }
@@ -618,31 +794,34 @@ event_handle_property_notify(xcb_property_notify_event_t *event)
   unagi_debug("PropertyNotify: window=%jx, atom=%ju",
               (uintmax_t) event->window, (uintmax_t) event->atom);
 
+  unagi_stats_event_handle(event->time);
+
+  /* Cached values are fetched again before any handler reads them */
+  unagi_property_notify(event);
+
   /* If the background image has been updated */
   if(unagi_atoms_is_background_atom(event->atom) &&
      event->window == globalconf.screen->root)
     {
       unagi_debug("New background Pixmap set");
-      globalconf.background_reset = true;
       (*globalconf.rendering->reset_background)();
     }
 
+  /* Background windows are capped depending on the active one */
+  if(event->atom == globalconf.ewmh._NET_ACTIVE_WINDOW &&
+     event->window == globalconf.screen->root)
+    unagi_rate_update_active();
+
+  /* Client hints set on top-level or active windows */
+  unagi_client_property_notify(event);
+
   /* Update _NET_SUPPORTED value */
   if(event->atom == globalconf.ewmh._NET_SUPPORTED)
     unagi_atoms_update_supported(event);
 
-  /* As plugins  requirements are  only atoms, if  the plugin  did not
-     meet the requirements on startup, it can try again... */
-  unagi_window_t *window = unagi_window_list_get(event->window);
-
-  for(unagi_plugin_t *plugin = globalconf.plugins; plugin; plugin = plugin->next)
-    if(plugin->vtable->events.property)
-      {
-	(*plugin->vtable->events.property)(event, window);
-
-	if(!plugin->enable && plugin->vtable->check_requirements)
-	  plugin->enable = (*plugin->vtable->check_requirements)();
-      }
+  /* Plugins may also meet their requirements only now */
+  if(globalconf.plugins_hooks.events.property.len)
+    unagi_plugin_property_notify(event, unagi_window_list_get(event->window));
 }
 
 /** Handler for  Mapping event reported  when the keyboard  mapping is
@@ -681,6 +860,8 @@ unagi_event_handle(xcb_generic_event_t *event)
 {
   const uint8_t response_type = XCB_EVENT_RESPONSE_TYPE(event);
 
+  globalconf.stats.events++;
+
   if(response_type == 0)
     {
       event_handle_error((void *) event);
@@ -699,6 +880,27 @@ unagi_event_handle(xcb_generic_event_t *event)
       event_handle_randr_screen_change_notify((void *) event);
       return;
     }
+  else if(globalconf.extensions.randr_crtc_notify &&
+          response_type == (globalconf.extensions.randr->first_event +
+                            XCB_RANDR_NOTIFY))
+    {
+      event_handle_randr_notify((void *) event);
+      return;
+    }
+  else if(globalconf.extensions.shape &&
+          response_type == (globalconf.extensions.shape->first_event +
+                            XCB_SHAPE_NOTIFY))
+    {
+      event_handle_shape_notify((void *) event);
+      return;
+    }
+  else if(globalconf.extensions.sync &&
+          response_type == (globalconf.extensions.sync->first_event +
+                            XCB_SYNC_ALARM_NOTIFY))
+    {
+      event_handle_sync_alarm_notify((void *) event);
+      return;
+    }
 
   switch(response_type)
     {
@@ -720,6 +922,195 @@ unagi_event_handle(xcb_generic_event_t *event)
     }
 }
 
+/** Size of the windows hash table used while coalescing a batch */
+#define EVENT_BATCH_WINDOWS_SIZE (UNAGI_EVENT_BATCH_MAX * 2)
+
+/** What is known about a window  while going backward through a batch:
+ *  the next event referring to it (if any) and whether it is destroyed
+ *  later on in the batch
+ */
+typedef struct
+{
+  xcb_window_t window;
+  /** Response type of the next event referring to the window, 0 if it
+      can not be coalesced with an earlier one */
+  uint8_t next_type;
+  /** Index in the batch of this next event */
+  unsigned int next_index;
+  bool is_destroyed;
+} event_batch_window_t;
+
+/** Get the entry of a window in the batch windows hash table, adding it
+ *  if needed (the table is  twice as large as  a batch, thus never
+ *  full)
+ */
+static event_batch_window_t *
+event_batch_window_get(event_batch_window_t *windows, const xcb_window_t window)
+{
+  unsigned int index = (window * 2654435761U) % EVENT_BATCH_WINDOWS_SIZE;
+
+  while(windows[index].window != XCB_NONE && windows[index].window != window)
+    index = (index + 1) % EVENT_BATCH_WINDOWS_SIZE;
+
+  windows[index].window = window;
+  return &windows[index];
+}
+
+/** Drop the events of a batch superseded by later ones, they are freed
+ *  and replaced by NULL.  The batch is  walked backward so that  the
+ *  next event referring to each window is known:
+ *
+ *  - a ConfigureNotify  is dropped if  the next event referring to the
+ *    window (including as  the sibling of another ConfigureNotify) is
+ *    another ConfigureNotify, which gives the final geometry anyway;
+ *  - a MapNotify directly followed by an UnmapNotify of the same window
+ *    are both dropped as the window has never been painted meanwhile;
+ *  - a DamageNotify is dropped if the window is destroyed later on.
+ *
+ *  DamageNotify  events in-between do  not prevent coalescing as the
+ *  whole window is damaged by the remaining events anyway.
+ *
+ * \param events The events batch
+ * \param events_nb The number of events in the batch
+ * \return The number of events dropped
+ */
+static unsigned int
+event_batch_coalesce(xcb_generic_event_t **events, const unsigned int events_nb)
+{
+  event_batch_window_t windows[EVENT_BATCH_WINDOWS_SIZE];
+  memset(windows, 0, sizeof(windows));
+
+  const uint8_t damage_notify_type = globalconf.extensions.damage->first_event +
+    XCB_DAMAGE_NOTIFY;
+
+  unsigned int dropped_nb = 0;
+
+  for(int event_n = (int) events_nb - 1; event_n >= 0; event_n--)
+    {
+      const uint8_t response_type = XCB_EVENT_RESPONSE_TYPE(events[event_n]);
+      event_batch_window_t *window = NULL;
+      bool drop = false;
+
+      if(response_type == damage_notify_type)
+        {
+          window = event_batch_window_get(windows,
+                                          ((xcb_damage_notify_event_t *) events[event_n])->drawable);
+
+          drop = window->is_destroyed;
+        }
+      else switch(response_type)
+        {
+        case XCB_CONFIGURE_NOTIFY:
+          {
+            xcb_configure_notify_event_t *event = (void *) events[event_n];
+            window = event_batch_window_get(windows, event->window);
+
+            drop = (window->next_type == XCB_CONFIGURE_NOTIFY);
+            window->next_type = XCB_CONFIGURE_NOTIFY;
+
+            /* The position of the sibling in the stack matters */
+            if(!drop && event->above_sibling != XCB_NONE)
+              event_batch_window_get(windows, event->above_sibling)->next_type = 0;
+          }
+
+          break;
+
+        case XCB_MAP_NOTIFY:
+          window = event_batch_window_get(windows,
+                                          ((xcb_map_notify_event_t *) events[event_n])->window);
+
+          if(window->next_type == XCB_UNMAP_NOTIFY)
+            {
+              free(events[window->next_index]);
+              events[window->next_index] = NULL;
+              dropped_nb++;
+              drop = true;
+            }
+
+          window->next_type = 0;
+          break;
+
+        case XCB_UNMAP_NOTIFY:
+          window = event_batch_window_get(windows,
+                                          ((xcb_unmap_notify_event_t *) events[event_n])->window);
+
+          window->next_type = XCB_UNMAP_NOTIFY;
+          window->next_index = (unsigned int) event_n;
+          break;
+
+        case XCB_DESTROY_NOTIFY:
+          window = event_batch_window_get(windows,
+                                          ((xcb_destroy_notify_event_t *) events[event_n])->window);
+
+          window->next_type = 0;
+          window->is_destroyed = true;
+          break;
+
+        /* Identifiers may be reused: events before the creation refer
+           to another window */
+        case XCB_CREATE_NOTIFY:
+          window = event_batch_window_get(windows,
+                                          ((xcb_create_notify_event_t *) events[event_n])->window);
+
+          window->next_type = 0;
+          window->is_destroyed = false;
+          break;
+
+        case XCB_REPARENT_NOTIFY:
+          event_batch_window_get(windows,
+                                 ((xcb_reparent_notify_event_t *) events[event_n])->window)->next_type = 0;
+          break;
+
+        case XCB_CIRCULATE_NOTIFY:
+          event_batch_window_get(windows,
+                                 ((xcb_circulate_notify_event_t *) events[event_n])->window)->next_type = 0;
+          break;
+        }
+
+      if(drop)
+        {
+          free(events[event_n]);
+          events[event_n] = NULL;
+          dropped_nb++;
+        }
+    }
+
+  return dropped_nb;
+}
+
+/** Drain up to UNAGI_EVENT_BATCH_MAX events from the queue, drop the
+ *  ones superseded by later events and dispatch the remaining ones
+ *
+ * \param poll_func xcb_poll_for_event() or xcb_poll_for_queued_event()
+ * \return The number of events drained
+ */
+unsigned int
+unagi_event_handle_batch(xcb_generic_event_t *(*poll_func)(xcb_connection_t *))
+{
+  xcb_generic_event_t *events[UNAGI_EVENT_BATCH_MAX];
+  unsigned int events_nb = 0;
+
+  while(events_nb < UNAGI_EVENT_BATCH_MAX &&
+        (events[events_nb] = (*poll_func)(globalconf.connection)) != NULL)
+    events_nb++;
+
+  if(events_nb > 1)
+    globalconf.stats.events_coalesced += event_batch_coalesce(events, events_nb);
+
+  for(unsigned int event_n = 0; event_n < events_nb; event_n++)
+    if(events[event_n])
+      {
+        unagi_event_handle(events[event_n]);
+        free(events[event_n]);
+      }
+
+  /* The replies  of windows  added  by  these events may  have  been
+     received along with them */
+  unagi_window_collect_pending();
+
+  return events_nb;
+}
+
 /** Handle all events in the queue
  *
  * \param event_handler The event handler function to call for each event
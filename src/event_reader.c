@@ -0,0 +1,208 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include <xcb/xcb.h>
+
+#include "event_reader.h"
+#include "structs.h"
+#include "util.h"
+#include "protocol.h"
+
+/** Event read by the reader thread */
+typedef struct
+{
+  xcb_generic_event_t *event;
+  /** When it has been read, in the X server time base */
+  uint32_t read_time;
+} event_reader_entry_t;
+
+/** Single-producer  (the  reader  thread)  single-consumer  (the
+ *  compositor loop) ring buffer of events. The producer only blocks
+ *  when the ring is full, until the consumer pops an event
+ */
+static struct
+{
+  pthread_t thread;
+  bool is_running;
+  event_reader_entry_t ring[UNAGI_EVENT_READER_RING_SIZE];
+  /** Next entry to be popped, only written by the consumer */
+  atomic_uint head;
+  /** Next entry to be pushed, only written by the producer */
+  atomic_uint tail;
+  atomic_bool stop;
+  /** Only used when the ring is full */
+  atomic_bool is_producer_waiting;
+  pthread_mutex_t mutex;
+  pthread_cond_t not_full;
+} _event_reader = {
+  .mutex = PTHREAD_MUTEX_INITIALIZER,
+  .not_full = PTHREAD_COND_INITIALIZER
+};
+
+static inline bool
+_event_reader_is_full(void)
+{
+  return (atomic_load(&_event_reader.tail) - atomic_load(&_event_reader.head)) ==
+    UNAGI_EVENT_READER_RING_SIZE;
+}
+
+/** Wait until the consumer pops an event.  The flag is set before the
+ *  ring is checked again, and the consumer pops before checking the
+ *  flag, so that a wakeup cannot be missed
+ */
+static void
+_event_reader_wait_not_full(void)
+{
+  pthread_mutex_lock(&_event_reader.mutex);
+  atomic_store(&_event_reader.is_producer_waiting, true);
+
+  while(_event_reader_is_full() && !atomic_load(&_event_reader.stop))
+    pthread_cond_wait(&_event_reader.not_full, &_event_reader.mutex);
+
+  atomic_store(&_event_reader.is_producer_waiting, false);
+  pthread_mutex_unlock(&_event_reader.mutex);
+}
+
+/** Reader thread: block on the X connection and push events into the
+ *  ring buffer, then wake up the compositor loop.  XCB being
+ *  thread-safe, the compositor loop keeps sending requests and getting
+ *  replies on the same connection meanwhile
+ */
+static void *
+_event_reader_thread(void *arg __attribute__((unused)))
+{
+  while(!atomic_load(&_event_reader.stop))
+    {
+      xcb_generic_event_t *event = xcb_wait_for_event(globalconf.connection);
+
+      /* The connection has been closed, checked by the compositor loop */
+      if(!event)
+        {
+          ev_async_send(globalconf.event_loop, &globalconf.event_async_watcher);
+          break;
+        }
+
+      if(_event_reader_is_full())
+        _event_reader_wait_not_full();
+
+      if(atomic_load(&_event_reader.stop))
+        {
+          free(event);
+          break;
+        }
+
+      const unsigned int tail = atomic_load_explicit(&_event_reader.tail,
+                                                     memory_order_relaxed);
+
+      event_reader_entry_t *entry =
+        &_event_reader.ring[tail & (UNAGI_EVENT_READER_RING_SIZE - 1)];
+
+      entry->event = event;
+      entry->read_time = unagi_stats_server_time();
+
+      atomic_store_explicit(&_event_reader.tail, tail + 1, memory_order_release);
+
+      /* Cheap if the compositor loop has not handled the previous one yet */
+      ev_async_send(globalconf.event_loop, &globalconf.event_async_watcher);
+    }
+
+  return NULL;
+}
+
+/** Start the  reader thread, the compositor loop must not poll events
+ *  from the X connection anymore afterwards
+ */
+void
+unagi_event_reader_start(void)
+{
+  atomic_store(&_event_reader.head, 0);
+  atomic_store(&_event_reader.tail, 0);
+  atomic_store(&_event_reader.stop, false);
+
+  if(pthread_create(&_event_reader.thread, NULL, _event_reader_thread, NULL))
+    unagi_fatal("Cannot create events reader thread");
+
+  _event_reader.is_running = true;
+}
+
+/** Pop an event read by the reader thread, with the same prototype as
+ *  xcb_poll_for_event() to be given to unagi_event_handle_batch()
+ *
+ * \param c The X connection (unused)
+ * \return The event or NULL if there is none
+ */
+xcb_generic_event_t *
+unagi_event_reader_pop(xcb_connection_t *c __attribute__((unused)))
+{
+  const unsigned int head = atomic_load_explicit(&_event_reader.head,
+                                                 memory_order_relaxed);
+
+  if(head == atomic_load_explicit(&_event_reader.tail, memory_order_acquire))
+    return NULL;
+
+  const event_reader_entry_t entry =
+    _event_reader.ring[head & (UNAGI_EVENT_READER_RING_SIZE - 1)];
+
+  atomic_store(&_event_reader.head, head + 1);
+
+  if(atomic_load(&_event_reader.is_producer_waiting))
+    {
+      pthread_mutex_lock(&_event_reader.mutex);
+      pthread_cond_signal(&_event_reader.not_full);
+      pthread_mutex_unlock(&_event_reader.mutex);
+    }
+
+  unagi_stats_event_read(entry.event, entry.read_time);
+  return entry.event;
+}
+
+/** Make the compositor loop handle the events left in the ring buffer
+ *  on its next iteration
+ */
+void
+unagi_event_reader_wakeup(void)
+{
+  ev_async_send(globalconf.event_loop, &globalconf.event_async_watcher);
+}
+
+/** Stop the  reader thread,  which is  woken up from  xcb_wait_for_event()
+ *  by an event sent to the CM window (delivered to its creator as
+ *  there is no event mask), and free the events not handled
+ */
+void
+unagi_event_reader_stop(void)
+{
+  if(!_event_reader.is_running)
+    return;
+
+  atomic_store(&_event_reader.stop, true);
+
+  pthread_mutex_lock(&_event_reader.mutex);
+  pthread_cond_signal(&_event_reader.not_full);
+  pthread_mutex_unlock(&_event_reader.mutex);
+
+  if(!xcb_connection_has_error(globalconf.connection))
+    {
+      xcb_client_message_event_t wakeup_event;
+      memset(&wakeup_event, 0, sizeof(wakeup_event));
+      wakeup_event.response_type = XCB_CLIENT_MESSAGE;
+      wakeup_event.format = 32;
+      wakeup_event.window = globalconf.cm_window;
+      wakeup_event.type = XCB_ATOM_NONE;
+
+      xcb_send_event(globalconf.connection, false, globalconf.cm_window,
+                     XCB_EVENT_MASK_NO_EVENT, (const char *) &wakeup_event);
+
+      xcb_flush(globalconf.connection);
+    }
+
+  pthread_join(_event_reader.thread, NULL);
+  _event_reader.is_running = false;
+
+  xcb_generic_event_t *event;
+  while((event = unagi_event_reader_pop(globalconf.connection)) != NULL)
+    free(event);
+}
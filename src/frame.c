@@ -0,0 +1,225 @@
+#include <stdlib.h>
+#include <assert.h>
+
+#include <xcb/xcb.h>
+#include <xcb/xcbext.h>
+#include <xcb/sync.h>
+
+#include "frame.h"
+#include "structs.h"
+#include "util.h"
+#include "protocol.h"
+
+/** Forget about the oldest frame in flight once the X server is known
+ *  to have processed it, and account how late the server was
+ */
+static void
+_frame_retire(void)
+{
+  const unsigned int head = globalconf.frames.head;
+
+  /* As replies are sent in the requests order, the QueryFence reply
+     has already been received with the frame tracking request one */
+  if(globalconf.frames.fence_cookies[head].sequence)
+    {
+      xcb_sync_query_fence_reply_t *fence_reply =
+        xcb_sync_query_fence_reply(globalconf.connection,
+                                   globalconf.frames.fence_cookies[head],
+                                   NULL);
+
+      if(fence_reply && !fence_reply->triggered)
+        globalconf.stats.fence_stalls++;
+
+      free(fence_reply);
+      globalconf.frames.fence_cookies[head].sequence = 0;
+    }
+
+  unagi_stats_server_lag(ev_time() - globalconf.frames.submit_times[head]);
+
+  globalconf.frames.head = (head + 1) % UNAGI_FRAMES_IN_FLIGHT_MAX;
+  globalconf.frames.len--;
+}
+
+/** Retire, without  blocking, all the  frames whose  tracking request
+ *  reply  has already  been received.   As  replies are  sent in  the
+ *  requests order, stop at the first one which is still pending
+ */
+static void
+_frame_collect(void)
+{
+  while(globalconf.frames.len)
+    {
+      void *reply = NULL;
+      xcb_generic_error_t *error = NULL;
+
+      if(!xcb_poll_for_reply(globalconf.connection,
+                             globalconf.frames.cookies[globalconf.frames.head].sequence,
+                             &reply, &error))
+        break;
+
+      free(reply);
+      free(error);
+      _frame_retire();
+    }
+}
+
+/** Before reusing  the Fence triggered N  frames ago, make the X server
+ *  wait (on the server-side, the compositor itself does not block) for
+ *  the rendering of that frame to complete, thus keeping exactly N
+ *  frames in flight
+ */
+static void
+_frame_fence_await(void)
+{
+  const unsigned int fence_n = globalconf.frames.fence_n;
+  const unsigned int tail = (globalconf.frames.head + globalconf.frames.len) %
+    UNAGI_FRAMES_IN_FLIGHT_MAX;
+
+  globalconf.frames.fence_cookies[tail].sequence = 0;
+
+  if(!globalconf.frames.fences_triggered[fence_n])
+    return;
+
+  const xcb_sync_fence_t fence = globalconf.frames.fences[fence_n];
+
+  /* Only meaningful to report whether the server had to wait */
+  globalconf.frames.fence_cookies[tail] =
+    xcb_sync_query_fence_unchecked(globalconf.connection, fence);
+
+  xcb_sync_await_fence(globalconf.connection, 1, &fence);
+  xcb_sync_reset_fence(globalconf.connection, fence);
+  globalconf.frames.fences_triggered[fence_n] = false;
+}
+
+/** Set up frames tracking according to the mode given on the command
+ *  line, fallback on sequence numbers if SYNC Fences are not supported
+ *
+ * \see unagi_display_init_extensions_finalise
+ */
+void
+unagi_frame_init(void)
+{
+  if(!globalconf.frames.max_len)
+    globalconf.frames.max_len = UNAGI_FRAMES_IN_FLIGHT;
+  /* One more frame is tracked while the next one is being painted */
+  else if(globalconf.frames.max_len >= UNAGI_FRAMES_IN_FLIGHT_MAX)
+    {
+      unagi_warn("At most %d frames in flight", UNAGI_FRAMES_IN_FLIGHT_MAX - 1);
+      globalconf.frames.max_len = UNAGI_FRAMES_IN_FLIGHT_MAX - 1;
+    }
+
+  if(globalconf.frames.mode != UNAGI_FRAME_SYNC_FENCE)
+    return;
+
+  if(!globalconf.extensions.sync)
+    {
+      unagi_warn("SYNC extension 3.1 not available, tracking frames with "
+                 "sequence numbers");
+
+      globalconf.frames.mode = UNAGI_FRAME_SYNC_SEQUENCE;
+      return;
+    }
+
+  for(unsigned int fence_n = 0; fence_n < globalconf.frames.max_len; fence_n++)
+    {
+      globalconf.frames.fences[fence_n] = xcb_generate_id(globalconf.connection);
+
+      xcb_sync_create_fence(globalconf.connection, globalconf.screen->root,
+                            globalconf.frames.fences[fence_n], false);
+    }
+}
+
+/** Called before painting a  new frame: only block if the X server is
+ *  still more than the maximum number of frames in flight behind, this
+ *  bounds the requests queued on the server-side without requiring a
+ *  round trip at each frame as xcb_aux_sync() did
+ */
+void
+unagi_frame_throttle(void)
+{
+  _frame_collect();
+
+  if(globalconf.frames.len > globalconf.frames.max_len)
+    {
+      const ev_tstamp wait_start = ev_time();
+
+      unagi_debug("X server lagging %u frames behind, waiting",
+                  globalconf.frames.len);
+
+      do
+        {
+          free(xcb_get_input_focus_reply(globalconf.connection,
+                                         globalconf.frames.cookies[globalconf.frames.head],
+                                         NULL));
+
+          _frame_retire();
+        }
+      while(globalconf.frames.len > globalconf.frames.max_len);
+
+      globalconf.stats.frames_throttled++;
+      globalconf.stats.throttle_wait_time += ev_time() - wait_start;
+    }
+
+  if(globalconf.frames.mode == UNAGI_FRAME_SYNC_FENCE)
+    _frame_fence_await();
+}
+
+/** Called once the last request of a frame (the final Composite) has
+ *  been sent: trigger the frame Fence if any, and track its completion
+ *  through the sequence number of a cheap request whose reply will only
+ *  be polled
+ */
+void
+unagi_frame_submit(void)
+{
+  assert(globalconf.frames.len < UNAGI_FRAMES_IN_FLIGHT_MAX);
+
+  if(globalconf.frames.mode == UNAGI_FRAME_SYNC_FENCE)
+    {
+      const unsigned int fence_n = globalconf.frames.fence_n;
+
+      xcb_sync_trigger_fence(globalconf.connection,
+                             globalconf.frames.fences[fence_n]);
+
+      globalconf.frames.fences_triggered[fence_n] = true;
+      globalconf.frames.fence_n = (fence_n + 1) % globalconf.frames.max_len;
+    }
+
+  const unsigned int tail = (globalconf.frames.head + globalconf.frames.len) %
+    UNAGI_FRAMES_IN_FLIGHT_MAX;
+
+  globalconf.frames.cookies[tail] = xcb_get_input_focus_unchecked(globalconf.connection);
+  globalconf.frames.submit_times[tail] = ev_time();
+  globalconf.frames.len++;
+
+  globalconf.stats.frames++;
+  unagi_stats_frame_sequence(globalconf.frames.cookies[tail].sequence);
+  unagi_stats_protocol_frame();
+
+  xcb_flush(globalconf.connection);
+}
+
+/** Discard the replies of frames still in flight and free the Fences */
+void
+unagi_frame_cleanup(void)
+{
+  while(globalconf.frames.len)
+    {
+      const unsigned int head = globalconf.frames.head;
+
+      if(globalconf.frames.fence_cookies[head].sequence)
+        xcb_discard_reply(globalconf.connection,
+                          globalconf.frames.fence_cookies[head].sequence);
+
+      xcb_discard_reply(globalconf.connection,
+                        globalconf.frames.cookies[head].sequence);
+
+      globalconf.frames.head = (head + 1) % UNAGI_FRAMES_IN_FLIGHT_MAX;
+      globalconf.frames.len--;
+    }
+
+  if(globalconf.frames.mode == UNAGI_FRAME_SYNC_FENCE)
+    for(unsigned int fence_n = 0; fence_n < globalconf.frames.max_len; fence_n++)
+      xcb_sync_destroy_fence(globalconf.connection,
+                             globalconf.frames.fences[fence_n]);
+}
@@ -0,0 +1,112 @@
+#include <stdbool.h>
+
+#include "governor.h"
+#include "structs.h"
+#include "util.h"
+
+/** Painting quality is degraded by tiers when frames keep taking longer
+ *  than the refresh interval, rather than only stretching the repaint
+ *  interval, and restored once the load has fallen for a while
+ */
+static struct
+{
+  unagi_governor_tier_t tier;
+  /** Consecutive frames over budget, or well under budget */
+  unsigned int overruns;
+  unsigned int underruns;
+  /** When the current tier has been entered, or its time accounted */
+  double tier_time;
+} _governor;
+
+static const char *_governor_tier_label[] = {
+  "none",
+  "fast_filter",
+  "bounding_damage",
+  "half_rate"
+};
+
+/** Account the time spent in the current tier
+ *
+ * \param now The current time
+ */
+void
+unagi_governor_stats_update(const double now)
+{
+  if(_governor.tier_time)
+    globalconf.stats.governor_tier_time[_governor.tier] += now - _governor.tier_time;
+
+  _governor.tier_time = now;
+}
+
+/** Switch to another tier
+ *
+ * \param tier The new tier
+ * \param now The current time
+ */
+static void
+_governor_set_tier(const unagi_governor_tier_t tier, const double now)
+{
+  unagi_debug("Governor: tier %s -> %s",
+              _governor_tier_label[_governor.tier], _governor_tier_label[tier]);
+
+  unagi_governor_stats_update(now);
+
+  if(tier > _governor.tier)
+    globalconf.stats.governor_degradations++;
+  else
+    globalconf.stats.governor_restorations++;
+
+  _governor.tier = tier;
+  _governor.overruns = _governor.underruns = 0;
+}
+
+/** Account the time taken to paint a frame against the refresh interval
+ *
+ * \param paint_time The frame painting time
+ * \param now The current time
+ */
+void
+unagi_governor_frame(const float paint_time, const double now)
+{
+  if(globalconf.governor_disabled)
+    return;
+
+  if(!_governor.tier_time)
+    _governor.tier_time = now;
+
+  if(paint_time > globalconf.refresh_rate_interval)
+    {
+      _governor.underruns = 0;
+
+      if(++_governor.overruns >= UNAGI_GOVERNOR_OVERRUN_FRAMES &&
+         _governor.tier + 1 < UNAGI_GOVERNOR_TIERS_NB)
+        _governor_set_tier(_governor.tier + 1, now);
+    }
+  else if(paint_time < globalconf.refresh_rate_interval / 2)
+    {
+      _governor.overruns = 0;
+
+      if(++_governor.underruns >= UNAGI_GOVERNOR_UNDERRUN_FRAMES &&
+         _governor.tier > UNAGI_GOVERNOR_TIER_NONE)
+        _governor_set_tier(_governor.tier - 1, now);
+    }
+  /* Within budget, but not enough to restore quality */
+  else
+    _governor.overruns = _governor.underruns = 0;
+}
+
+/** \return The current tier */
+unagi_governor_tier_t
+unagi_governor_get_tier(void)
+{
+  return _governor.tier;
+}
+
+/** \param tier The tier
+ *  \return The tier label, used in logs and statistics
+ */
+const char *
+unagi_governor_get_tier_label(const unagi_governor_tier_t tier)
+{
+  return _governor_tier_label[tier];
+}
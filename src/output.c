@@ -0,0 +1,263 @@
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include <xcb/xcb.h>
+#include <xcb/xcbext.h>
+#include <xcb/xfixes.h>
+#include <xcb/randr.h>
+#include <xcb/dpms.h>
+
+#include "output.h"
+#include "structs.h"
+#include "display.h"
+#include "util.h"
+#include "protocol.h"
+
+/** CRTC state as last reported by RandR */
+typedef struct
+{
+  xcb_randr_crtc_t id;
+  /** Screen-relative area (meaningless when disabled) */
+  xcb_rectangle_t rectangle;
+  bool is_enabled;
+} _output_crtc_t;
+
+static struct
+{
+  /** All the CRTCs, including the disabled ones */
+  _output_crtc_t *crtcs;
+  unsigned int crtcs_len;
+  unsigned int crtcs_size;
+  /** Whether the enabled CRTCs do not cover the whole screen, thus the
+      damaged Region is clipped to them */
+  bool is_clipped;
+  /** Region of the enabled CRTCs, only meaningful when clipping */
+  xcb_xfixes_region_t region;
+  bool is_region_outdated;
+  /** Whether the monitors have been powered down through DPMS */
+  bool is_dpms_off;
+  /** Pending DPMSInfo request, its reply is only polled */
+  xcb_dpms_info_cookie_t dpms_cookie;
+  double dpms_check_time;
+  /** Whether painting is suspended as all outputs are off, and since
+      when */
+  bool is_suspended;
+  double suspend_time;
+} _output;
+
+/** Forget about the CRTCs, before getting all of them again from RandR
+ *
+ * \see unagi_display_update_screen_information
+ */
+void
+unagi_output_crtcs_reset(void)
+{
+  _output.crtcs_len = 0;
+}
+
+/** Update the state of a CRTC, the area of a CRTC which has just been
+ *  enabled (or moved) is damaged, as it was not painted meanwhile if it
+ *  was not covered by another output.  unagi_output_update() must be
+ *  called afterwards
+ *
+ * \param crtc The CRTC identifier
+ * \param mode The CRTC mode, None if it is disabled
+ * \param x The CRTC x position on the screen
+ * \param y The CRTC y position on the screen
+ * \param width The CRTC width
+ * \param height The CRTC height
+ */
+void
+unagi_output_crtc_update(const xcb_randr_crtc_t crtc,
+                         const xcb_randr_mode_t mode,
+                         const int16_t x, const int16_t y,
+                         const uint16_t width, const uint16_t height)
+{
+  _output_crtc_t *output_crtc = NULL;
+  for(unsigned int n = 0; n < _output.crtcs_len; n++)
+    if(_output.crtcs[n].id == crtc)
+      {
+        output_crtc = &_output.crtcs[n];
+        break;
+      }
+
+  if(!output_crtc)
+    {
+      if(_output.crtcs_len == _output.crtcs_size)
+        {
+          _output.crtcs_size = _output.crtcs_size ? _output.crtcs_size * 2 : 4;
+          _output.crtcs = realloc(_output.crtcs,
+                                  _output.crtcs_size * sizeof(_output_crtc_t));
+        }
+
+      output_crtc = &_output.crtcs[_output.crtcs_len++];
+      output_crtc->id = crtc;
+      output_crtc->is_enabled = false;
+    }
+
+  const xcb_rectangle_t rectangle = {
+    .x = x, .y = y, .width = width, .height = height
+  };
+
+  const bool is_enabled = (mode != XCB_NONE && width && height);
+
+  if(is_enabled &&
+     (!output_crtc->is_enabled ||
+      output_crtc->rectangle.x != x || output_crtc->rectangle.y != y ||
+      output_crtc->rectangle.width != width ||
+      output_crtc->rectangle.height != height))
+    unagi_display_add_damaged_rectangle(&rectangle);
+
+  output_crtc->rectangle = rectangle;
+  output_crtc->is_enabled = is_enabled;
+}
+
+/** Suspend painting when all  the outputs are off (either through DPMS
+ *  or because all the CRTCs are disabled).  Damage is still tracked
+ *  meanwhile, and painted at once when any of them is back on.  When
+ *  the enabled CRTCs do not cover the whole screen, painting is clipped
+ *  to them
+ */
+void
+unagi_output_update(void)
+{
+  /* Nothing known from RandR, assume the whole screen is shown */
+  bool is_enabled = !_output.crtcs_len;
+  bool is_clipped = !is_enabled;
+
+  for(unsigned int n = 0; n < _output.crtcs_len; n++)
+    if(_output.crtcs[n].is_enabled)
+      {
+        is_enabled = true;
+
+        if(unagi_window_rectangle_covers_screen(&_output.crtcs[n].rectangle))
+          is_clipped = false;
+      }
+
+  _output.is_clipped = is_enabled && is_clipped;
+  _output.is_region_outdated = true;
+
+  const bool is_suspended = _output.is_dpms_off || !is_enabled;
+  if(is_suspended == _output.is_suspended)
+    return;
+
+  const double now = ev_time();
+
+  if(is_suspended)
+    {
+      unagi_debug("All outputs are off, suspending painting");
+
+      globalconf.stats.outputs_suspensions++;
+      _output.suspend_time = now;
+    }
+  else
+    {
+      unagi_debug("Outputs are back on, painting the damage");
+
+      globalconf.stats.outputs_suspended_time += now - _output.suspend_time;
+    }
+
+  _output.is_suspended = is_suspended;
+}
+
+/** As DPMS does not report  its state changes, get the  reply of the
+ *  previous DPMSInfo request if it has already been received, then
+ *  send another one if the last check is old enough.  This never
+ *  blocks, and the request is flushed by the caller
+ *
+ * \param now The current time
+ */
+void
+unagi_output_dpms_check(const double now)
+{
+  if(!globalconf.extensions.dpms)
+    return;
+
+  if(_output.dpms_cookie.sequence)
+    {
+      xcb_dpms_info_reply_t *dpms_reply = NULL;
+      xcb_generic_error_t *error = NULL;
+
+      if(!xcb_poll_for_reply(globalconf.connection, _output.dpms_cookie.sequence,
+                             (void **) &dpms_reply, &error))
+        return;
+
+      _output.dpms_cookie.sequence = 0;
+
+      if(dpms_reply)
+        {
+          const bool is_dpms_off = dpms_reply->state &&
+            dpms_reply->power_level != XCB_DPMS_DPMS_MODE_ON;
+
+          if(is_dpms_off != _output.is_dpms_off)
+            {
+              _output.is_dpms_off = is_dpms_off;
+              unagi_output_update();
+            }
+        }
+
+      free(dpms_reply);
+      free(error);
+    }
+
+  if(now - _output.dpms_check_time < UNAGI_OUTPUT_DPMS_CHECK_INTERVAL)
+    return;
+
+  _output.dpms_check_time = now;
+  _output.dpms_cookie = xcb_dpms_info_unchecked(globalconf.connection);
+}
+
+/** \return true if painting is suspended as all outputs are off */
+bool
+unagi_output_is_suspended(void)
+{
+  return _output.is_suspended;
+}
+
+/** Clip the damaged Region to the enabled CRTCs, if they do not cover
+ *  the whole screen, called before painting
+ */
+void
+unagi_output_clip_damaged(void)
+{
+  if(!_output.is_clipped || !globalconf.damaged)
+    return;
+
+  if(_output.is_region_outdated)
+    {
+      xcb_rectangle_t rectangles[_output.crtcs_len];
+      uint32_t rectangles_len = 0;
+
+      for(unsigned int n = 0; n < _output.crtcs_len; n++)
+        if(_output.crtcs[n].is_enabled)
+          rectangles[rectangles_len++] = _output.crtcs[n].rectangle;
+
+      if(_output.region == XCB_NONE)
+        {
+          _output.region = xcb_generate_id(globalconf.connection);
+          xcb_xfixes_create_region(globalconf.connection, _output.region,
+                                   rectangles_len, rectangles);
+        }
+      else
+        xcb_xfixes_set_region(globalconf.connection, _output.region,
+                              rectangles_len, rectangles);
+
+      _output.is_region_outdated = false;
+    }
+
+  xcb_xfixes_intersect_region(globalconf.connection, globalconf.damaged,
+                              _output.region, globalconf.damaged);
+}
+
+/** Free the resources allocated to track the outputs state */
+void
+unagi_output_cleanup(void)
+{
+  if(_output.dpms_cookie.sequence)
+    xcb_discard_reply(globalconf.connection, _output.dpms_cookie.sequence);
+
+  if(_output.region != XCB_NONE)
+    xcb_xfixes_destroy_region(globalconf.connection, _output.region);
+
+  free(_output.crtcs);
+}
@@ -0,0 +1,478 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include <xcb/xcb.h>
+#include <xcb/xfixes.h>
+#include <xcb/render.h>
+#include <xcb/sync.h>
+#include <xcb/xcb_event.h>
+
+#include "paint_thread.h"
+#include "structs.h"
+#include "util.h"
+#include "vsync.h"
+#include "display.h"
+#include "event.h"
+#include "protocol.h"
+
+/* The  requests  sent  on  the  paint  thread  connection  are  not
+   accounted (the XCB functions are parenthesised to bypass protocol.h
+   macros) as statistics are only updated by the compositor loop */
+
+/** Frame painted by the compositor loop in a buffer Picture, then
+ *  presented by the paint thread.   Once submitted, it is not modified
+ *  by the compositor loop until the paint thread has presented it
+ */
+typedef struct
+{
+  /** Whether the frame has been submitted and not presented yet */
+  bool is_submitted;
+  /** Buffer Picture painted by the compositor loop */
+  xcb_render_picture_t source;
+  /** Root (or overlay) Picture */
+  xcb_render_picture_t destination;
+  /** Screen size when the frame was painted */
+  uint16_t width;
+  uint16_t height;
+  /** Damaged Region of the frame only (not what the buffer missed
+      while the other one was painted) */
+  xcb_xfixes_region_t region;
+  /** Bounding box of the Region */
+  xcb_rectangle_t extents;
+  /** Presented without waiting for VBlank (low-latency mode) */
+  bool is_immediate;
+  /** Triggered by the compositor loop once the buffer has been
+      painted, awaited by the paint thread */
+  xcb_sync_fence_t ready_fence;
+  /** Triggered by the paint thread once the buffer has been presented,
+      awaited by the compositor loop before painting it again */
+  xcb_sync_fence_t done_fence;
+} _paint_thread_frame_t;
+
+static struct
+{
+  /** Connection only used by the paint thread */
+  xcb_connection_t *connection;
+  pthread_t thread;
+  bool is_running;
+  bool stop;
+  /** Set by the paint thread when its connection is broken, checked by
+      the compositor loop */
+  bool has_error;
+  _paint_thread_frame_t frames[UNAGI_PAINT_THREAD_BUFFERS];
+  /** Next buffer painted by the compositor loop */
+  unsigned int paint_n;
+  /** Next buffer presented by the paint thread */
+  unsigned int present_n;
+  /** Number of frames submitted, only written by the compositor loop */
+  uint64_t submitted;
+  /** Number of frames presented, only written by the paint thread */
+  uint64_t presented;
+  /** Protect the frames state and the stop flag */
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} _paint_thread = {
+  .mutex = PTHREAD_MUTEX_INITIALIZER,
+  .cond = PTHREAD_COND_INITIALIZER
+};
+
+/** Log the errors received on the paint thread connection, as its
+ *  requests are not checked, and discard any other event
+ *
+ * \param c The paint thread connection
+ */
+static void
+_paint_thread_drain_events(xcb_connection_t *c)
+{
+  xcb_generic_event_t *event;
+  while((event = xcb_poll_for_event(c)))
+    {
+      if(XCB_EVENT_RESPONSE_TYPE(event) == 0)
+        unagi_event_log_error((xcb_generic_error_t *) event);
+
+      free(event);
+    }
+}
+
+/** Paint thread:  wait for frames in  the order they  are painted, then
+ *  wait for VBlank and copy the damaged part of the buffer Picture to
+ *  the root Picture.  The X server only processes the copy once the
+ *  compositor loop requests painting the buffer have been processed,
+ *  thanks to the frame Fence.  Frames left are presented before exiting
+ */
+static void *
+_paint_thread_run(void *arg __attribute__((unused)))
+{
+  xcb_connection_t *c = _paint_thread.connection;
+
+  for(;;)
+    {
+      _paint_thread_frame_t *frame = &_paint_thread.frames[_paint_thread.present_n];
+
+      pthread_mutex_lock(&_paint_thread.mutex);
+
+      while(!frame->is_submitted && !_paint_thread.stop)
+        pthread_cond_wait(&_paint_thread.cond, &_paint_thread.mutex);
+
+      if(!frame->is_submitted)
+        {
+          pthread_mutex_unlock(&_paint_thread.mutex);
+          break;
+        }
+
+      const _paint_thread_frame_t snapshot = *frame;
+      pthread_mutex_unlock(&_paint_thread.mutex);
+
+      if(!snapshot.is_immediate)
+        vsync_wait();
+
+      (xcb_sync_await_fence)(c, 1, &snapshot.ready_fence);
+      (xcb_sync_reset_fence)(c, snapshot.ready_fence);
+
+      (xcb_xfixes_set_picture_clip_region)(c, snapshot.destination,
+                                           snapshot.region, 0, 0);
+
+      (xcb_render_composite)(c, XCB_RENDER_PICT_OP_SRC,
+                             snapshot.source, XCB_NONE, snapshot.destination,
+                             0, 0, 0, 0, 0, 0,
+                             snapshot.width, snapshot.height);
+
+      (xcb_sync_trigger_fence)(c, snapshot.done_fence);
+      xcb_flush(c);
+
+      _paint_thread_drain_events(c);
+
+      /* Nothing can be presented anymore, release all the frames so
+         that the compositor loop does not wait for them */
+      if(xcb_connection_has_error(c))
+        {
+          pthread_mutex_lock(&_paint_thread.mutex);
+
+          _paint_thread.has_error = true;
+          for(unsigned int n = 0; n < UNAGI_PAINT_THREAD_BUFFERS; n++)
+            _paint_thread.frames[n].is_submitted = false;
+
+          pthread_cond_broadcast(&_paint_thread.cond);
+          pthread_mutex_unlock(&_paint_thread.mutex);
+          break;
+        }
+
+      pthread_mutex_lock(&_paint_thread.mutex);
+      frame->is_submitted = false;
+      _paint_thread.presented++;
+      pthread_cond_broadcast(&_paint_thread.cond);
+      pthread_mutex_unlock(&_paint_thread.mutex);
+
+      /* The frames of clients painted in it can be reported as drawn */
+      ev_async_send(globalconf.event_loop, &globalconf.event_present_watcher);
+
+      _paint_thread.present_n = (_paint_thread.present_n + 1) %
+        UNAGI_PAINT_THREAD_BUFFERS;
+    }
+
+  return NULL;
+}
+
+/** Open  the paint  thread connection and  negotiate  the  extensions
+ *  versions, as XFixes and SYNC requests are rejected otherwise
+ *
+ * \return True if the connection can be used
+ */
+static bool
+_paint_thread_connect(void)
+{
+  _paint_thread.connection = xcb_connect(NULL, NULL);
+  if(xcb_connection_has_error(_paint_thread.connection))
+    {
+      xcb_disconnect(_paint_thread.connection);
+      _paint_thread.connection = NULL;
+      return false;
+    }
+
+  xcb_connection_t *c = _paint_thread.connection;
+
+  const xcb_xfixes_query_version_cookie_t xfixes_cookie =
+    (xcb_xfixes_query_version)(c, XCB_XFIXES_MAJOR_VERSION,
+                               XCB_XFIXES_MINOR_VERSION);
+
+  const xcb_render_query_version_cookie_t render_cookie =
+    (xcb_render_query_version)(c, XCB_RENDER_MAJOR_VERSION,
+                               XCB_RENDER_MINOR_VERSION);
+
+  const xcb_sync_initialize_cookie_t sync_cookie =
+    (xcb_sync_initialize)(c, XCB_SYNC_MAJOR_VERSION, XCB_SYNC_MINOR_VERSION);
+
+  xcb_xfixes_query_version_reply_t *xfixes_reply =
+    xcb_xfixes_query_version_reply(c, xfixes_cookie, NULL);
+
+  xcb_render_query_version_reply_t *render_reply =
+    xcb_render_query_version_reply(c, render_cookie, NULL);
+
+  xcb_sync_initialize_reply_t *sync_reply =
+    xcb_sync_initialize_reply(c, sync_cookie, NULL);
+
+  const bool is_initialised = xfixes_reply && render_reply && sync_reply;
+
+  free(xfixes_reply);
+  free(render_reply);
+  free(sync_reply);
+
+  if(!is_initialised)
+    {
+      xcb_disconnect(c);
+      _paint_thread.connection = NULL;
+    }
+
+  return is_initialised;
+}
+
+/** Start the  paint  thread if  requested on the  command line, which
+ *  requires SYNC Fences and a buffer Picture, and must be called before
+ *  the rendering backend creates its buffer Pictures
+ *
+ * \see unagi_display_init_extensions_finalise
+ */
+void
+unagi_paint_thread_init(void)
+{
+  if(!globalconf.paint_thread)
+    return;
+
+  if(globalconf.paint_direct)
+    {
+      unagi_warn("No paint thread when painting directly on the overlay window");
+      globalconf.paint_thread = false;
+      return;
+    }
+
+  if(!globalconf.extensions.sync)
+    {
+      unagi_warn("SYNC extension 3.1 not available, painting without thread");
+      globalconf.paint_thread = false;
+      return;
+    }
+
+  if(!_paint_thread_connect())
+    {
+      unagi_warn("Cannot open paint thread connection, painting without thread");
+      globalconf.paint_thread = false;
+      return;
+    }
+
+  /* The  resources  are  created on  the  main  connection,  the  paint
+     thread only uses them.   The first frames are painted on the whole
+     screen anyway, as the buffers are blank */
+  const xcb_rectangle_t screen_rectangle = {
+    .x = 0, .y = 0, .width = globalconf.screen->width_in_pixels,
+    .height = globalconf.screen->height_in_pixels
+  };
+
+  for(unsigned int n = 0; n < UNAGI_PAINT_THREAD_BUFFERS; n++)
+    {
+      _paint_thread_frame_t *frame = &_paint_thread.frames[n];
+
+      frame->region = xcb_generate_id(globalconf.connection);
+      xcb_xfixes_create_region(globalconf.connection, frame->region,
+                               1, &screen_rectangle);
+
+      frame->extents = screen_rectangle;
+
+      frame->ready_fence = xcb_generate_id(globalconf.connection);
+      xcb_sync_create_fence(globalconf.connection, globalconf.screen->root,
+                            frame->ready_fence, false);
+
+      /* Nothing to wait for before painting a buffer the first time */
+      frame->done_fence = xcb_generate_id(globalconf.connection);
+      xcb_sync_create_fence(globalconf.connection, globalconf.screen->root,
+                            frame->done_fence, true);
+    }
+
+  _paint_thread.stop = false;
+  _paint_thread.has_error = false;
+
+  if(pthread_create(&_paint_thread.thread, NULL, _paint_thread_run, NULL))
+    unagi_fatal("Cannot create paint thread");
+
+  _paint_thread.is_running = true;
+}
+
+/** Get the  buffer to  paint  the next frame in,  only  blocking if the
+ *  paint thread has not presented the frame previously painted in it.
+ *  The global damaged Region is extended to what the buffer missed
+ *  while the other buffers were painted
+ *
+ * \return The buffer index
+ */
+unsigned int
+unagi_paint_thread_acquire(void)
+{
+  const unsigned int paint_n = _paint_thread.paint_n;
+  _paint_thread_frame_t *frame = &_paint_thread.frames[paint_n];
+
+  pthread_mutex_lock(&_paint_thread.mutex);
+
+  if(frame->is_submitted && !_paint_thread.has_error)
+    {
+      const ev_tstamp wait_start = ev_time();
+
+      do
+        pthread_cond_wait(&_paint_thread.cond, &_paint_thread.mutex);
+      while(frame->is_submitted && !_paint_thread.has_error);
+
+      globalconf.stats.present_waits++;
+      globalconf.stats.present_wait_time += ev_time() - wait_start;
+    }
+
+  const bool has_error = _paint_thread.has_error;
+  pthread_mutex_unlock(&_paint_thread.mutex);
+
+  /* As done for the main connection */
+  if(has_error)
+    unagi_fatal("Paint thread X connection invalid");
+
+  /* The X server may not have processed the copy of the buffer yet */
+  xcb_sync_await_fence(globalconf.connection, 1, &frame->done_fence);
+  xcb_sync_reset_fence(globalconf.connection, frame->done_fence);
+
+  if(globalconf.damaged)
+    {
+      xcb_xfixes_copy_region(globalconf.connection, globalconf.damaged,
+                             frame->region);
+
+      frame->extents = globalconf.damaged_extents;
+
+      for(unsigned int n = 1; n < UNAGI_PAINT_THREAD_BUFFERS; n++)
+        {
+          const _paint_thread_frame_t *other_frame =
+            &_paint_thread.frames[(paint_n + n) % UNAGI_PAINT_THREAD_BUFFERS];
+
+          xcb_xfixes_union_region(globalconf.connection, globalconf.damaged,
+                                  other_frame->region, globalconf.damaged);
+
+          unagi_display_add_damaged_extents(&other_frame->extents);
+        }
+    }
+  else
+    {
+      const xcb_rectangle_t screen_rectangle = {
+        .x = 0, .y = 0, .width = globalconf.screen->width_in_pixels,
+        .height = globalconf.screen->height_in_pixels
+      };
+
+      xcb_xfixes_set_region(globalconf.connection, frame->region,
+                            1, &screen_rectangle);
+
+      frame->extents = screen_rectangle;
+    }
+
+  return paint_n;
+}
+
+/** Hand the frame painted in the buffer over to the paint thread,
+ *  which presents it once the X server has processed the painting
+ *
+ * \param source The buffer Picture
+ * \param destination The root Picture
+ */
+void
+unagi_paint_thread_submit(xcb_render_picture_t source,
+                          xcb_render_picture_t destination)
+{
+  _paint_thread_frame_t *frame = &_paint_thread.frames[_paint_thread.paint_n];
+
+  xcb_sync_trigger_fence(globalconf.connection, frame->ready_fence);
+  xcb_flush(globalconf.connection);
+
+  pthread_mutex_lock(&_paint_thread.mutex);
+
+  frame->source = source;
+  frame->destination = destination;
+  frame->width = globalconf.screen->width_in_pixels;
+  frame->height = globalconf.screen->height_in_pixels;
+  frame->is_immediate = globalconf.paint_immediate;
+  frame->is_submitted = true;
+
+  pthread_cond_broadcast(&_paint_thread.cond);
+  pthread_mutex_unlock(&_paint_thread.mutex);
+
+  _paint_thread.paint_n = (_paint_thread.paint_n + 1) % UNAGI_PAINT_THREAD_BUFFERS;
+  _paint_thread.submitted++;
+}
+
+/** \return The number of frames submitted so far */
+uint64_t
+unagi_paint_thread_submitted(void)
+{
+  return _paint_thread.submitted;
+}
+
+/** \return The number of frames presented so far */
+uint64_t
+unagi_paint_thread_presented(void)
+{
+  pthread_mutex_lock(&_paint_thread.mutex);
+  const uint64_t presented = _paint_thread.presented;
+  pthread_mutex_unlock(&_paint_thread.mutex);
+
+  return presented;
+}
+
+/** Wait until all the frames have been presented and processed by the
+ *  X server, before freeing the Pictures they use
+ */
+void
+unagi_paint_thread_wait_idle(void)
+{
+  if(!_paint_thread.is_running)
+    return;
+
+  pthread_mutex_lock(&_paint_thread.mutex);
+
+  for(unsigned int n = 0; n < UNAGI_PAINT_THREAD_BUFFERS; n++)
+    while(_paint_thread.frames[n].is_submitted && !_paint_thread.has_error)
+      pthread_cond_wait(&_paint_thread.cond, &_paint_thread.mutex);
+
+  pthread_mutex_unlock(&_paint_thread.mutex);
+
+  free(xcb_get_input_focus_reply(_paint_thread.connection,
+                                 (xcb_get_input_focus)(_paint_thread.connection),
+                                 NULL));
+}
+
+/** Present the frames left, then stop the paint thread and free its
+ *  resources
+ */
+void
+unagi_paint_thread_stop(void)
+{
+  if(!_paint_thread.is_running)
+    return;
+
+  pthread_mutex_lock(&_paint_thread.mutex);
+  _paint_thread.stop = true;
+  pthread_cond_broadcast(&_paint_thread.cond);
+  pthread_mutex_unlock(&_paint_thread.mutex);
+
+  pthread_join(_paint_thread.thread, NULL);
+  _paint_thread.is_running = false;
+
+  free(xcb_get_input_focus_reply(_paint_thread.connection,
+                                 (xcb_get_input_focus)(_paint_thread.connection),
+                                 NULL));
+
+  xcb_disconnect(_paint_thread.connection);
+  _paint_thread.connection = NULL;
+
+  for(unsigned int n = 0; n < UNAGI_PAINT_THREAD_BUFFERS; n++)
+    {
+      xcb_xfixes_destroy_region(globalconf.connection,
+                                _paint_thread.frames[n].region);
+
+      xcb_sync_destroy_fence(globalconf.connection,
+                             _paint_thread.frames[n].ready_fence);
+
+      xcb_sync_destroy_fence(globalconf.connection,
+                             _paint_thread.frames[n].done_fence);
+    }
+}
@@ -82,6 +82,70 @@ unagi_plugin_load_all(void)
 
   if(opacity_plugin)
     _unagi_plugin_append_global(plugin, opacity_plugin);
+
+  /* None is enabled until its requirements are checked */
+  unagi_plugin_hooks_update();
+}
+
+/** Subscribe a plugin to a hook
+ *
+ * \param hook The hook
+ * \param plugin The plugin
+ */
+static void
+_unagi_plugin_hook_add(unagi_plugin_hook_t *hook, const unagi_plugin_t *plugin)
+{
+  if(hook->len == UNAGI_PLUGINS_HOOK_MAX)
+    {
+      unagi_warn("Too many plugins subscribed to the same hook, ignoring %s",
+                 plugin->vtable->name);
+      return;
+    }
+
+  hook->vtables[hook->len++] = plugin->vtable;
+}
+
+/** Rebuild the per-hook arrays of plugins, called whenever a plugin is
+ *  enabled or (de)activated rather than checking it on each call
+ */
+void
+unagi_plugin_hooks_update(void)
+{
+  unagi_plugin_hooks_t *hooks = &globalconf.plugins_hooks;
+  memset(hooks, 0, sizeof(unagi_plugin_hooks_t));
+
+#define HOOK_ADD(hook, func)                    \
+  if(plugin->vtable->func)                      \
+    _unagi_plugin_hook_add(&hooks->hook, plugin)
+
+  for(unagi_plugin_t *plugin = globalconf.plugins; plugin; plugin = plugin->next)
+    {
+      /* May meet its requirements later on */
+      HOOK_ADD(events.property, events.property);
+
+      if(!plugin->enable || !plugin->vtable->activated)
+        continue;
+
+      HOOK_ADD(events.damage, events.damage);
+      HOOK_ADD(events.randr_screen_change_notify, events.randr_screen_change_notify);
+      HOOK_ADD(events.key_press, events.key_press);
+      HOOK_ADD(events.key_release, events.key_release);
+      HOOK_ADD(events.mapping, events.mapping);
+      HOOK_ADD(events.button_release, events.button_release);
+      HOOK_ADD(events.motion_notify, events.motion_notify);
+      HOOK_ADD(events.circulate, events.circulate);
+      HOOK_ADD(events.configure, events.configure);
+      HOOK_ADD(events.create, events.create);
+      HOOK_ADD(events.destroy, events.destroy);
+      HOOK_ADD(events.map, events.map);
+      HOOK_ADD(events.reparent, events.reparent);
+      HOOK_ADD(events.unmap, events.unmap);
+      HOOK_ADD(window_get_opacity, window_get_opacity);
+      HOOK_ADD(pre_paint, pre_paint);
+      HOOK_ADD(post_paint, post_paint);
+    }
+
+#undef HOOK_ADD
 }
 
 /** Enable the plugin if it meets the requirements */
@@ -91,6 +155,42 @@ unagi_plugin_check_requirements(void)
   for(unagi_plugin_t *plugin = globalconf.plugins; plugin; plugin = plugin->next)
     plugin->enable = (!plugin->vtable->check_requirements ? true :
 		     (*plugin->vtable->check_requirements)());
+
+  unagi_plugin_hooks_update();
+}
+
+/** Give a PropertyNotify to the plugins handling it, even if not enabled
+ *  yet: as plugins requirements are only atoms, if the plugin did not
+ *  meet the requirements on startup, it can try again...
+ *
+ * \param event The X PropertyNotify event
+ * \param window The window object, if managed
+ */
+void
+unagi_plugin_property_notify(xcb_property_notify_event_t *event,
+                             unagi_window_t *window)
+{
+  bool is_enabled = false;
+
+  for(unsigned int hook_n = 0;
+      hook_n < globalconf.plugins_hooks.events.property.len;
+      hook_n++)
+    {
+      const unagi_plugin_vtable_t *vtable =
+        globalconf.plugins_hooks.events.property.vtables[hook_n];
+
+      (*vtable->events.property)(event, window);
+
+      if(!vtable->check_requirements)
+        continue;
+
+      unagi_plugin_t *plugin = unagi_plugin_search_by_name(vtable->name);
+      if(!plugin->enable && (plugin->enable = (*vtable->check_requirements)()))
+        is_enabled = true;
+    }
+
+  if(is_enabled)
+    unagi_plugin_hooks_update();
 }
 
 /** Look for a plugin from its name
@@ -122,4 +222,7 @@ unagi_plugin_unload_all(void)
       free(plugin);
       plugin = plugin_next;
     }
+
+  globalconf.plugins = NULL;
+  unagi_plugin_hooks_update();
 }
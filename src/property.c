@@ -0,0 +1,380 @@
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include <xcb/xcb.h>
+#include <xcb/xcbext.h>
+
+#include "property.h"
+#include "structs.h"
+#include "util.h"
+#include "protocol.h"
+
+/** Property value cached for a given window */
+typedef struct _unagi_property_t
+{
+  xcb_window_t window;
+  xcb_atom_t atom;
+  /** Pending GetProperty request, its reply is only polled */
+  xcb_get_property_cookie_t cookie;
+  /** Last reply received, NULL if the property is not set */
+  xcb_get_property_reply_t *reply;
+  /** Next property in the same bucket */
+  struct _unagi_property_t *next;
+  /** Next property whose reply is awaited */
+  struct _unagi_property_t *pending_next;
+} unagi_property_t;
+
+/** Window properties are cached, keyed by (window, atom), for both the
+ *  compositor and plugins rather than each one sending GetProperty
+ *  requests.  Watched atoms are prefetched at once when a window is
+ *  mapped, cached values are fetched again on PropertyNotify (a single
+ *  invalidation path) and the replies are polled before painting, thus
+ *  rarely waited for
+ */
+static struct
+{
+  unagi_property_t *buckets[UNAGI_PROPERTY_BUCKETS];
+  /** Properties whose reply is awaited */
+  unagi_property_t *pending;
+  /** Atoms prefetched when a window is mapped */
+  xcb_atom_t watched[UNAGI_PROPERTY_WATCHED_MAX];
+  unsigned int watched_len;
+} _property;
+
+/** \param window_id The Window XID
+ *  \param atom The property Atom
+ *  \return The bucket of this key
+ */
+static inline unsigned int
+_property_hash(const xcb_window_t window_id, const xcb_atom_t atom)
+{
+  return ((window_id ^ (atom * 2654435761U)) * 2654435761U >> 16) &
+    (UNAGI_PROPERTY_BUCKETS - 1);
+}
+
+/** Look for a cached property
+ *
+ * \param window_id The Window XID
+ * \param atom The property Atom
+ * \return The cached property or NULL
+ */
+static unagi_property_t *
+_property_lookup(const xcb_window_t window_id, const xcb_atom_t atom)
+{
+  for(unagi_property_t *property = _property.buckets[_property_hash(window_id, atom)];
+      property; property = property->next)
+    if(property->window == window_id && property->atom == atom)
+      return property;
+
+  return NULL;
+}
+
+/** Send a GetProperty request for a cached property, superseding the
+ *  previous one if any.  The request is not flushed
+ *
+ * \param property The cached property
+ */
+static void
+_property_fetch(unagi_property_t *property)
+{
+  if(property->cookie.sequence)
+    xcb_discard_reply(globalconf.connection, property->cookie.sequence);
+  else
+    {
+      property->pending_next = _property.pending;
+      _property.pending = property;
+    }
+
+  property->cookie = xcb_get_property_unchecked(globalconf.connection, false,
+                                                property->window, property->atom,
+                                                XCB_GET_PROPERTY_TYPE_ANY, 0,
+                                                UNAGI_PROPERTY_LENGTH_MAX);
+
+  globalconf.stats.property_requests++;
+}
+
+/** Cache a property and send its GetProperty request if not already
+ *  cached
+ *
+ * \param window_id The Window XID
+ * \param atom The property Atom
+ * \return The cached property
+ */
+static unagi_property_t *
+_property_add(const xcb_window_t window_id, const xcb_atom_t atom)
+{
+  unagi_property_t *property = _property_lookup(window_id, atom);
+  if(property)
+    {
+      globalconf.stats.property_hits++;
+      return property;
+    }
+
+  const unsigned int bucket = _property_hash(window_id, atom);
+
+  property = calloc(1, sizeof(unagi_property_t));
+  property->window = window_id;
+  property->atom = atom;
+  property->next = _property.buckets[bucket];
+  _property.buckets[bucket] = property;
+
+  _property_fetch(property);
+  return property;
+}
+
+/** Remove a property from the pending list
+ *
+ * \param property The cached property
+ */
+static void
+_property_pending_remove(unagi_property_t *property)
+{
+  for(unagi_property_t **p = &_property.pending; *p; p = &(*p)->pending_next)
+    if(*p == property)
+      {
+        *p = property->pending_next;
+        break;
+      }
+
+  property->pending_next = NULL;
+}
+
+/** Store the reply of a property, already removed from the pending
+ *  list
+ *
+ * \param property The cached property
+ * \param reply The GetProperty reply, NULL on error
+ */
+static void
+_property_resolve(unagi_property_t *property, xcb_get_property_reply_t *reply)
+{
+  property->cookie.sequence = 0;
+
+  /* Not set, thus stored as not set at all */
+  if(reply && reply->type == XCB_NONE)
+    {
+      free(reply);
+      reply = NULL;
+    }
+
+  free(property->reply);
+  property->reply = reply;
+}
+
+/** Get the reply of a property without blocking
+ *
+ * \param property The cached property
+ * \return true if there is no reply awaited anymore
+ */
+static bool
+_property_poll(unagi_property_t *property)
+{
+  if(!property->cookie.sequence)
+    return true;
+
+  xcb_get_property_reply_t *reply = NULL;
+  xcb_generic_error_t *error = NULL;
+
+  if(!xcb_poll_for_reply(globalconf.connection, property->cookie.sequence,
+                         (void **) &reply, &error))
+    return false;
+
+  free(error);
+
+  _property_pending_remove(property);
+  _property_resolve(property, reply);
+  return true;
+}
+
+/** Prefetch this Atom on all the windows mapped from now on
+ *
+ * \param atom The property Atom
+ */
+void
+unagi_property_watch(const xcb_atom_t atom)
+{
+  for(unsigned int atom_n = 0; atom_n < _property.watched_len; atom_n++)
+    if(_property.watched[atom_n] == atom)
+      return;
+
+  if(_property.watched_len == UNAGI_PROPERTY_WATCHED_MAX)
+    {
+      unagi_warn("Too many properties watched, %ju is not prefetched",
+                 (uintmax_t) atom);
+      return;
+    }
+
+  _property.watched[_property.watched_len++] = atom;
+}
+
+/** Send GetProperty requests at once for the properties of a window
+ *  which are not cached yet, their replies are collected later on
+ *
+ * \param window_id The Window XID
+ * \param atoms_len The number of Atoms
+ * \param atoms The property Atoms
+ */
+void
+unagi_property_prefetch(const xcb_window_t window_id, const unsigned int atoms_len,
+                        const xcb_atom_t *atoms)
+{
+  for(unsigned int atom_n = 0; atom_n < atoms_len; atom_n++)
+    _property_add(window_id, atoms[atom_n]);
+
+  xcb_flush(globalconf.connection);
+}
+
+/** Prefetch the watched properties of a window being mapped
+ *
+ * \param window The window object
+ */
+void
+unagi_property_manage(const unagi_window_t *window)
+{
+  if(_property.watched_len)
+    unagi_property_prefetch(window->id, _property.watched_len, _property.watched);
+}
+
+/** Get a cached property without blocking, fetching it if needed
+ *
+ * \param window_id The Window XID
+ * \param atom The property Atom
+ * \param reply Where to store the property, NULL if not set
+ * \return true if the value is up-to-date, false if the reply is still
+ *         awaited (reply is then the previous value if any)
+ */
+bool
+unagi_property_poll(const xcb_window_t window_id, const xcb_atom_t atom,
+                    const xcb_get_property_reply_t **reply)
+{
+  unagi_property_t *property = _property_add(window_id, atom);
+
+  const bool is_resolved = _property_poll(property);
+  *reply = property->reply;
+
+  /* In case the request has just been sent */
+  if(!is_resolved)
+    xcb_flush(globalconf.connection);
+
+  return is_resolved;
+}
+
+/** Get a cached property, fetching it if needed, and only waiting for
+ *  the reply if it has not been collected yet
+ *
+ * \param window_id The Window XID
+ * \param atom The property Atom
+ * \return The property, NULL if not set
+ */
+const xcb_get_property_reply_t *
+unagi_property_get(const xcb_window_t window_id, const xcb_atom_t atom)
+{
+  unagi_property_t *property = _property_add(window_id, atom);
+
+  if(!_property_poll(property))
+    {
+      _property_pending_remove(property);
+      _property_resolve(property,
+                        xcb_get_property_reply(globalconf.connection,
+                                               property->cookie, NULL));
+    }
+
+  return property->reply;
+}
+
+/** On  receiving a  PropertyNotify, fetch  again the  property  if it is
+ *  cached, called before any other handler
+ *
+ * \param event The X PropertyNotify event
+ */
+void
+unagi_property_notify(const xcb_property_notify_event_t *event)
+{
+  unagi_property_t *property = _property_lookup(event->window, event->atom);
+  if(!property)
+    return;
+
+  if(event->state == XCB_PROPERTY_NEW_VALUE)
+    {
+      _property_fetch(property);
+      xcb_flush(globalconf.connection);
+      return;
+    }
+
+  /* Deleted, no need to ask the X server */
+  if(property->cookie.sequence)
+    {
+      xcb_discard_reply(globalconf.connection, property->cookie.sequence);
+      _property_pending_remove(property);
+    }
+
+  _property_resolve(property, NULL);
+}
+
+/** Collect the replies received since the last painting */
+void
+unagi_property_collect(void)
+{
+  unagi_property_t *property = _property.pending;
+  while(property)
+    {
+      unagi_property_t *next = property->pending_next;
+      _property_poll(property);
+      property = next;
+    }
+}
+
+/** Free the cached properties of a window
+ *
+ * \param property The cached property
+ */
+static void
+_property_free(unagi_property_t *property)
+{
+  if(property->cookie.sequence)
+    {
+      xcb_discard_reply(globalconf.connection, property->cookie.sequence);
+      _property_pending_remove(property);
+    }
+
+  free(property->reply);
+  free(property);
+}
+
+/** Free the cached properties of a window being freed
+ *
+ * \param window_id The Window XID
+ */
+void
+unagi_property_window_remove(const xcb_window_t window_id)
+{
+  for(unsigned int bucket = 0; bucket < UNAGI_PROPERTY_BUCKETS; bucket++)
+    {
+      unagi_property_t **p = &_property.buckets[bucket];
+      while(*p)
+        {
+          unagi_property_t *property = *p;
+          if(property->window != window_id)
+            {
+              p = &property->next;
+              continue;
+            }
+
+          *p = property->next;
+          _property_free(property);
+        }
+    }
+}
+
+/** Free all the cached properties */
+void
+unagi_property_cleanup(void)
+{
+  for(unsigned int bucket = 0; bucket < UNAGI_PROPERTY_BUCKETS; bucket++)
+    while(_property.buckets[bucket])
+      {
+        unagi_property_t *property = _property.buckets[bucket];
+        _property.buckets[bucket] = property->next;
+        _property_free(property);
+      }
+}
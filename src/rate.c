@@ -0,0 +1,400 @@
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include <xcb/xcb.h>
+#include <xcb/xcbext.h>
+#include <xcb/xcb_ewmh.h>
+
+#include "rate.h"
+#include "structs.h"
+#include "display.h"
+#include "governor.h"
+#include "client.h"
+#include "util.h"
+#include "protocol.h"
+
+/** Windows which are not focused are only painted at a lower rate: the
+ *  damage they report in the meantime is accumulated as a bounding box
+ *  and flushed at once.  The focused window (found from
+ *  _NET_ACTIVE_WINDOW, which the top-level window is looked for as it
+ *  may be reparented by the window manager), fullscreen and
+ *  override-redirect windows (menus, tooltips...) keep the full rate.
+ *  The governor halves this rate when painting is over budget
+ */
+static struct
+{
+  /** Minimum interval between two paintings of a background window,
+      0 if they are not capped */
+  double interval;
+  /** Pending GetProperty request of _NET_ACTIVE_WINDOW, its reply is
+      only polled */
+  xcb_get_property_cookie_t active_cookie;
+  /** Pending QueryTree request to find the top-level window containing
+      the active window */
+  xcb_query_tree_cookie_t tree_cookie;
+  xcb_window_t tree_window;
+  /** Whether the window manager sets _NET_ACTIVE_WINDOW, otherwise no
+      window is capped */
+  bool is_active_known;
+  /** Top-level window containing the active window */
+  xcb_window_t active;
+  /** Active window itself, which may be a child of the one above */
+  xcb_window_t active_client;
+  /** Windows whose damage is deferred */
+  unagi_window_t *deferred;
+} _rate;
+
+/** \return The minimum interval between two paintings of a background
+ *          window, which is doubled by the governor when painting is
+ *          over budget, 0 if they are not capped
+ */
+static double
+_rate_get_interval(void)
+{
+  if(unagi_governor_get_tier() < UNAGI_GOVERNOR_TIER_HALF_RATE)
+    return _rate.interval;
+
+  return 2 * (_rate.interval ? _rate.interval : globalconf.refresh_rate_interval);
+}
+
+/** Remove a window from the deferred list, without painting its damage
+ *
+ * \param window The window object
+ */
+static void
+_rate_deferred_remove(unagi_window_t *window)
+{
+  for(unagi_window_t **w = &_rate.deferred; *w; w = &(*w)->rate_deferred_next)
+    if(*w == window)
+      {
+        *w = window->rate_deferred_next;
+        break;
+      }
+
+  window->rate_deferred_next = NULL;
+  window->is_rate_deferred = false;
+}
+
+/** Paint the damage accumulated for a window (already removed from the
+ *  deferred list) at the next frame
+ *
+ * \param window The window object
+ * \param now The current time
+ */
+static void
+_rate_window_flush(unagi_window_t *window, const double now)
+{
+  window->rate_flush_time = now;
+
+  /* It may have been unmapped in the meantime */
+  if(!unagi_window_is_visible(window))
+    return;
+
+  unagi_display_add_damaged_rectangle(&window->rate_deferred);
+
+  /* Its Damage object was not subtracted meanwhile, thus the same area
+     was not reported again, it must be from now on */
+  const float ratio = (float) (window->rate_deferred.width * window->rate_deferred.height) /
+    (float) (window_width_with_border(window->geometry) *
+             window_height_with_border(window->geometry));
+
+  window->damaged_ratio = max(window->damaged_ratio, ratio);
+  unagi_window_set_dirty(window);
+
+  globalconf.stats.background_flushes++;
+}
+
+/** Set the top-level window containing the active window, painting its
+ *  deferred damage right away
+ *
+ * \param window_id The top-level Window XID or None
+ */
+static void
+_rate_active_set(const xcb_window_t window_id)
+{
+  unagi_debug("Active top-level window: %jx", (uintmax_t) window_id);
+
+  _rate.active = window_id;
+
+  /* Its client hints are read on the active window */
+  unagi_client_set_active(window_id, _rate.active_client);
+
+  unagi_window_t *window = unagi_window_list_get(window_id);
+  if(window && window->is_rate_deferred)
+    {
+      _rate_deferred_remove(window);
+      _rate_window_flush(window, ev_now(globalconf.event_loop));
+    }
+}
+
+/** Look for the top-level window containing the given window, which is
+ *  already known if the window manager does not reparent windows,
+ *  otherwise its parents are queried
+ *
+ * \param window_id The Window XID
+ */
+static void
+_rate_active_resolve(const xcb_window_t window_id)
+{
+  if(window_id == XCB_NONE || unagi_window_list_get(window_id))
+    {
+      _rate_active_set(window_id);
+      return;
+    }
+
+  _rate.tree_window = window_id;
+  _rate.tree_cookie = xcb_query_tree_unchecked(globalconf.connection, window_id);
+  xcb_flush(globalconf.connection);
+}
+
+/** Get, without blocking, the replies of the requests sent to find the
+ *  active window
+ */
+static void
+_rate_active_collect(void)
+{
+  if(_rate.active_cookie.sequence)
+    {
+      xcb_get_property_reply_t *active_reply = NULL;
+      xcb_generic_error_t *error = NULL;
+
+      if(!xcb_poll_for_reply(globalconf.connection, _rate.active_cookie.sequence,
+                             (void **) &active_reply, &error))
+        return;
+
+      _rate.active_cookie.sequence = 0;
+
+      xcb_window_t window_id = XCB_NONE;
+      _rate.is_active_known = active_reply &&
+        xcb_ewmh_get_active_window_from_reply(&window_id, active_reply);
+
+      free(active_reply);
+      free(error);
+
+      _rate.active_client = window_id;
+      _rate_active_resolve(window_id);
+    }
+
+  if(_rate.tree_cookie.sequence)
+    {
+      xcb_query_tree_reply_t *tree_reply = NULL;
+      xcb_generic_error_t *error = NULL;
+
+      if(!xcb_poll_for_reply(globalconf.connection, _rate.tree_cookie.sequence,
+                             (void **) &tree_reply, &error))
+        return;
+
+      _rate.tree_cookie.sequence = 0;
+
+      /* The window has been destroyed in the meantime */
+      if(!tree_reply)
+        _rate_active_set(XCB_NONE);
+      else if(tree_reply->parent == globalconf.screen->root)
+        _rate_active_set(_rate.tree_window);
+      else
+        _rate_active_resolve(tree_reply->parent);
+
+      free(tree_reply);
+      free(error);
+    }
+}
+
+/** Check whether the window is only painted at a lower rate
+ *
+ * \param window The window object
+ * \return true if the window is capped
+ */
+static bool
+_rate_is_capped(const unagi_window_t *window)
+{
+  if(!_rate.is_active_known || window->id == _rate.active ||
+     !window->attributes || window->attributes->override_redirect)
+    return false;
+
+  /* Fullscreen windows keep the full rate */
+  return !unagi_window_is_fullscreen(window);
+}
+
+/** Check whether the window is the focused fullscreen window (or any
+ *  fullscreen window if the window manager does not set
+ *  _NET_ACTIVE_WINDOW), whose damage is painted right away in
+ *  low-latency mode
+ *
+ * \param window The window object
+ * \return true if the window is the focused fullscreen one
+ */
+bool
+unagi_rate_is_active_fullscreen(const unagi_window_t *window)
+{
+  _rate_active_collect();
+
+  return ((!_rate.is_active_known || window->id == _rate.active) &&
+          unagi_window_is_fullscreen(window));
+}
+
+/** Start tracking the active window, also needed for the client hints
+ *  (see client.c) and low-latency mode, thus even if background windows
+ *  are not capped
+ */
+void
+unagi_rate_init(void)
+{
+  if(globalconf.background_rate)
+    _rate.interval = 1.0 / (double) globalconf.background_rate;
+
+  unagi_rate_update_active();
+}
+
+/** On receiving a PropertyNotify for _NET_ACTIVE_WINDOW on the root
+ *  window, get its new value, superseding the previous requests
+ */
+void
+unagi_rate_update_active(void)
+{
+  if(_rate.active_cookie.sequence)
+    xcb_discard_reply(globalconf.connection, _rate.active_cookie.sequence);
+
+  if(_rate.tree_cookie.sequence)
+    {
+      xcb_discard_reply(globalconf.connection, _rate.tree_cookie.sequence);
+      _rate.tree_cookie.sequence = 0;
+    }
+
+  _rate.active_cookie =
+    xcb_ewmh_get_active_window_unchecked(&globalconf.ewmh, globalconf.screen_nbr);
+
+  xcb_flush(globalconf.connection);
+}
+
+/** Defer the damage reported  by a background window painted not long
+ *  ago, until its next flush (see unagi_rate_flush())
+ *
+ * \param window The window object
+ * \param area The screen-relative damaged rectangle
+ * \return true if the damage has been deferred
+ */
+bool
+unagi_rate_defer_damage(unagi_window_t *window, const xcb_rectangle_t *area)
+{
+  const double interval = _rate_get_interval();
+  if(!interval)
+    return false;
+
+  _rate_active_collect();
+
+  if(!_rate_is_capped(window))
+    return false;
+
+  if(!window->is_rate_deferred)
+    {
+      const double now = ev_now(globalconf.event_loop);
+
+      /* Not painted for long enough, so paint it right away, as well as
+         any damage reported until the loop is woken up again */
+      if(window->rate_flush_time == now ||
+         now - window->rate_flush_time >= interval)
+        {
+          window->rate_flush_time = now;
+          return false;
+        }
+
+      window->is_rate_deferred = true;
+      window->rate_deferred = *area;
+      window->rate_deferred_next = _rate.deferred;
+      _rate.deferred = window;
+    }
+  else
+    {
+      xcb_rectangle_t *deferred = &window->rate_deferred;
+
+      const int16_t x = min(deferred->x, area->x);
+      const int16_t y = min(deferred->y, area->y);
+
+      deferred->width = (uint16_t) (max(deferred->x + deferred->width,
+                                        area->x + area->width) - x);
+      deferred->height = (uint16_t) (max(deferred->y + deferred->height,
+                                         area->y + area->height) - y);
+      deferred->x = x;
+      deferred->y = y;
+    }
+
+  globalconf.stats.background_deferred++;
+  return true;
+}
+
+/** Forget about the deferred damage of a window being freed
+ *
+ * \param window The window object
+ */
+void
+unagi_rate_window_remove(unagi_window_t *window)
+{
+  if(window->is_rate_deferred)
+    _rate_deferred_remove(window);
+}
+
+/** Paint  the damage  deferred  for  the  windows  not  painted  for
+ *  long enough, or not capped anymore, called before painting.  Windows
+ *  are flushed half a refresh interval early, so that flushes stay
+ *  aligned on the paint timer slots
+ *
+ * \param now The current time
+ */
+void
+unagi_rate_flush(const double now)
+{
+  if(!_rate.deferred)
+    return;
+
+  _rate_active_collect();
+
+  const double interval = _rate_get_interval();
+  const double early = globalconf.refresh_rate_interval / 2;
+
+  unagi_window_t **w = &_rate.deferred;
+  while(*w)
+    {
+      unagi_window_t *window = *w;
+
+      if(now - window->rate_flush_time + early < interval &&
+         _rate_is_capped(window))
+        {
+          w = &window->rate_deferred_next;
+          continue;
+        }
+
+      *w = window->rate_deferred_next;
+      window->rate_deferred_next = NULL;
+      window->is_rate_deferred = false;
+
+      _rate_window_flush(window, now);
+    }
+}
+
+/** \return When the paint timer must fire for the next flush, or 0 if
+ *          there is no deferred damage
+ */
+double
+unagi_rate_next_flush_time(void)
+{
+  const double interval = _rate_get_interval();
+  double next_time = 0;
+
+  for(unagi_window_t *window = _rate.deferred; window;
+      window = window->rate_deferred_next)
+    if(!next_time || window->rate_flush_time + interval < next_time)
+      next_time = window->rate_flush_time + interval;
+
+  return next_time ? next_time - globalconf.refresh_rate_interval / 2 : 0;
+}
+
+/** Discard the requests still pending to find the active window */
+void
+unagi_rate_cleanup(void)
+{
+  if(_rate.active_cookie.sequence)
+    xcb_discard_reply(globalconf.connection, _rate.active_cookie.sequence);
+
+  if(_rate.tree_cookie.sequence)
+    xcb_discard_reply(globalconf.connection, _rate.tree_cookie.sequence);
+}
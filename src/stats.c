@@ -0,0 +1,453 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <ev.h>
+#include <xcb/xcb_event.h>
+
+#include "stats.h"
+#include "structs.h"
+#include "client.h"
+
+/** Reset all the statistics, called on startup */
+void
+unagi_stats_init(void)
+{
+  memset(&globalconf.stats, 0, sizeof(unagi_stats_t));
+  globalconf.stats.start_time = ev_time();
+  globalconf.stats.protocol_enabled = globalconf.stats_on_exit;
+}
+
+/** Account  the delay between  sending a frame  and knowing it  has been
+ *  processed by the X server
+ *
+ * \param lag The delay in seconds
+ */
+void
+unagi_stats_server_lag(const double lag)
+{
+  globalconf.stats.server_lag_sum += lag;
+  globalconf.stats.server_lag_count++;
+
+  if(lag > globalconf.stats.server_lag_max)
+    globalconf.stats.server_lag_max = lag;
+}
+
+/** Account the time spent to paint a frame
+ *
+ * \param paint_time The paint time in seconds
+ */
+void
+unagi_stats_paint_time(const double paint_time)
+{
+  unsigned int bucket = (unsigned int) (paint_time / UNAGI_STATS_PAINT_TIME_RESOLUTION);
+  if(bucket >= UNAGI_STATS_PAINT_TIME_BUCKETS)
+    bucket = UNAGI_STATS_PAINT_TIME_BUCKETS - 1;
+
+  globalconf.stats.paint_time_histogram[bucket]++;
+
+  if(paint_time > globalconf.stats.paint_time_max)
+    globalconf.stats.paint_time_max = paint_time;
+}
+
+/** Get  the current time in the X server time base, which is assumed
+ *  to run on the same host  and to use the  monotonic clock (as Xorg
+ *  and Xvfb do).  Safe to call from any thread
+ *
+ * \return The current time in milliseconds (wrapping around)
+ */
+uint32_t
+unagi_stats_server_time(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t) ((uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000);
+}
+
+/** Account an event latency in a histogram
+ *
+ * \param histogram The histogram
+ * \param event_time The event timestamp
+ * \param now The current time in the X server time base
+ */
+static inline void
+_stats_event_latency(uint32_t *histogram, const uint32_t event_time,
+                     const uint32_t now)
+{
+  const int32_t latency = (int32_t) (now - event_time);
+  if(latency < 0)
+    histogram[0]++;
+  else if(latency >= UNAGI_STATS_EVENT_LATENCY_BUCKETS)
+    histogram[UNAGI_STATS_EVENT_LATENCY_BUCKETS - 1]++;
+  else
+    histogram[latency]++;
+}
+
+/** Account  the delay until an event has been read from the X server,
+ *  only for PropertyNotify which carry a timestamp
+ *
+ * \param event The event
+ * \param read_time When it has been read, in the X server time base
+ */
+void
+unagi_stats_event_read(const xcb_generic_event_t *event, const uint32_t read_time)
+{
+  if(XCB_EVENT_RESPONSE_TYPE(event) == XCB_PROPERTY_NOTIFY)
+    _stats_event_latency(globalconf.stats.event_read_latency_histogram,
+                         ((const xcb_property_notify_event_t *) event)->time,
+                         read_time);
+}
+
+/** Account the delay until a PropertyNotify event has been handled
+ *
+ * \param event_time The event timestamp
+ */
+void
+unagi_stats_event_handle(const uint32_t event_time)
+{
+  _stats_event_latency(globalconf.stats.event_handle_latency_histogram,
+                       event_time, unagi_stats_server_time());
+}
+
+/** Account the requests sent since the  previous frame thanks to the
+ *  sequence number of the frame tracking request
+ *
+ * \param sequence The sequence number of the frame tracking request
+ */
+void
+unagi_stats_frame_sequence(const unsigned int sequence)
+{
+  if(globalconf.stats.last_frame_sequence)
+    globalconf.stats.requests += sequence - globalconf.stats.last_frame_sequence;
+
+  globalconf.stats.last_frame_sequence = sequence;
+}
+
+/** Account a request about to be sent, called by the protocol.h
+ *  macros wrapping XCB functions
+ *
+ * \param extension The extension of the request
+ * \param request The request name
+ * \param function The function sending the request
+ * \param bytes The request size
+ */
+void
+unagi_stats_protocol_request(const unagi_protocol_extension_t extension,
+                             const char *request,
+                             const char *function,
+                             const size_t bytes)
+{
+  if(!globalconf.stats.protocol_enabled)
+    return;
+
+  unagi_stats_protocol_extension_t *ext = &globalconf.stats.protocol[extension];
+  ext->requests++;
+  ext->bytes += bytes;
+  ext->frame_requests++;
+  ext->frame_bytes += bytes;
+
+  /* Literals and __func__ have static storage, so their addresses are
+     enough to identify a call site */
+  unsigned int index = (unsigned int)
+    ((((uintptr_t) request) >> 2) ^ (((uintptr_t) function) >> 2) * 31) %
+    UNAGI_STATS_PROTOCOL_CALLS_MAX;
+
+  for(unsigned int probe = 0; probe < UNAGI_STATS_PROTOCOL_CALLS_MAX; probe++)
+    {
+      unagi_stats_protocol_call_t *call = &globalconf.stats.protocol_calls[index];
+
+      if(!call->request)
+        {
+          call->request = request;
+          call->function = function;
+          call->extension = extension;
+        }
+
+      if(call->request == request && call->function == function)
+        {
+          call->requests++;
+          call->bytes += bytes;
+          return;
+        }
+
+      index = (index + 1) % UNAGI_STATS_PROTOCOL_CALLS_MAX;
+    }
+
+  globalconf.stats.protocol_calls_dropped++;
+}
+
+/** Called once a frame has been sent to keep track of the maximum
+ *  number of requests and bytes per frame
+ */
+void
+unagi_stats_protocol_frame(void)
+{
+  for(int extension = 0; extension < UNAGI_PROTOCOL_EXTENSIONS_NB; extension++)
+    {
+      unagi_stats_protocol_extension_t *ext = &globalconf.stats.protocol[extension];
+
+      if(ext->frame_requests > ext->frame_requests_max)
+        ext->frame_requests_max = ext->frame_requests;
+      if(ext->frame_bytes > ext->frame_bytes_max)
+        ext->frame_bytes_max = ext->frame_bytes;
+
+      ext->frame_requests = ext->frame_bytes = 0;
+    }
+}
+
+/** Get a percentile of the paint times from the histogram
+ *
+ * \param percentile The percentile (between 0 and 1)
+ * \return The paint time in seconds (upper bound of the bucket)
+ */
+static double
+_stats_paint_time_percentile(const double percentile)
+{
+  uint64_t total = 0;
+  for(int bucket = 0; bucket < UNAGI_STATS_PAINT_TIME_BUCKETS; bucket++)
+    total += globalconf.stats.paint_time_histogram[bucket];
+
+  if(!total)
+    return 0.0;
+
+  const uint64_t rank = (uint64_t) (percentile * (double) total);
+  uint64_t counter = 0;
+  for(int bucket = 0; bucket < UNAGI_STATS_PAINT_TIME_BUCKETS; bucket++)
+    {
+      counter += globalconf.stats.paint_time_histogram[bucket];
+      if(counter > rank)
+        return (bucket + 1) * UNAGI_STATS_PAINT_TIME_RESOLUTION;
+    }
+
+  return globalconf.stats.paint_time_max;
+}
+
+/** Get a percentile of an events latency histogram
+ *
+ * \param histogram The histogram
+ * \param percentile The percentile (between 0 and 1)
+ * \return The latency in milliseconds (upper bound of the bucket)
+ */
+static unsigned int
+_stats_event_latency_percentile(const uint32_t *histogram, const double percentile)
+{
+  uint64_t total = 0;
+  for(int bucket = 0; bucket < UNAGI_STATS_EVENT_LATENCY_BUCKETS; bucket++)
+    total += histogram[bucket];
+
+  if(!total)
+    return 0;
+
+  const uint64_t rank = (uint64_t) (percentile * (double) total);
+  uint64_t counter = 0;
+  for(int bucket = 0; bucket < UNAGI_STATS_EVENT_LATENCY_BUCKETS; bucket++)
+    {
+      counter += histogram[bucket];
+      if(counter > rank)
+        return (unsigned int) bucket + 1;
+    }
+
+  return UNAGI_STATS_EVENT_LATENCY_BUCKETS;
+}
+
+/** Average of a sum over a counter, 0 if the counter is 0 */
+static inline double
+_stats_average(const double sum, const uint64_t counter)
+{
+  return counter ? sum / (double) counter : 0.0;
+}
+
+static const char *_stats_protocol_extensions_name[] = {
+  [UNAGI_PROTOCOL_CORE] = "core",
+  [UNAGI_PROTOCOL_XFIXES] = "xfixes",
+  [UNAGI_PROTOCOL_DAMAGE] = "damage",
+  [UNAGI_PROTOCOL_RENDER] = "render",
+  [UNAGI_PROTOCOL_COMPOSITE] = "composite",
+  [UNAGI_PROTOCOL_SYNC] = "sync",
+  [UNAGI_PROTOCOL_SHAPE] = "shape"
+};
+
+/** Sort calls by decreasing number of requests */
+static int
+_stats_protocol_call_cmp(const void *a, const void *b)
+{
+  const unagi_stats_protocol_call_t *call_a = a;
+  const unagi_stats_protocol_call_t *call_b = b;
+
+  if(call_a->requests == call_b->requests)
+    return 0;
+
+  return call_a->requests < call_b->requests ? 1 : -1;
+}
+
+/** Dump requests per extension, then per calling function, the busiest
+ *  first
+ *
+ * \param stream Where to write the statistics
+ */
+static void
+_stats_protocol_dump(FILE *stream)
+{
+  const unagi_stats_t *stats = &globalconf.stats;
+  const uint64_t frames = stats->frames;
+
+  for(int extension = 0; extension < UNAGI_PROTOCOL_EXTENSIONS_NB; extension++)
+    {
+      const unagi_stats_protocol_extension_t *ext = &stats->protocol[extension];
+      const char *name = _stats_protocol_extensions_name[extension];
+
+      fprintf(stream, "protocol_%s_requests: %" PRIu64 "\n", name, ext->requests);
+      fprintf(stream, "protocol_%s_bytes: %" PRIu64 "\n", name, ext->bytes);
+      fprintf(stream, "protocol_%s_requests_per_frame: %.2f\n", name,
+              _stats_average((double) ext->requests, frames));
+      fprintf(stream, "protocol_%s_bytes_per_frame: %.2f\n", name,
+              _stats_average((double) ext->bytes, frames));
+      fprintf(stream, "protocol_%s_requests_frame_max: %" PRIu64 "\n", name,
+              ext->frame_requests_max);
+      fprintf(stream, "protocol_%s_bytes_frame_max: %" PRIu64 "\n", name,
+              ext->frame_bytes_max);
+    }
+
+  unagi_stats_protocol_call_t calls[UNAGI_STATS_PROTOCOL_CALLS_MAX];
+  unsigned int calls_nb = 0;
+  for(int call_n = 0; call_n < UNAGI_STATS_PROTOCOL_CALLS_MAX; call_n++)
+    if(stats->protocol_calls[call_n].request)
+      calls[calls_nb++] = stats->protocol_calls[call_n];
+
+  qsort(calls, calls_nb, sizeof(unagi_stats_protocol_call_t),
+        _stats_protocol_call_cmp);
+
+  for(unsigned int call_n = 0; call_n < calls_nb; call_n++)
+    fprintf(stream, "protocol_call: %s %s %s requests=%" PRIu64 " bytes=%" PRIu64
+            " per_frame=%.2f\n",
+            _stats_protocol_extensions_name[calls[call_n].extension],
+            calls[call_n].request, calls[call_n].function,
+            calls[call_n].requests, calls[call_n].bytes,
+            _stats_average((double) calls[call_n].requests, frames));
+
+  if(stats->protocol_calls_dropped)
+    fprintf(stream, "protocol_calls_dropped: %" PRIu64 "\n",
+            stats->protocol_calls_dropped);
+}
+
+/** Dump the server resources held for windows, compared to the number
+ *  of windows
+ *
+ * \param stream The stream to write to
+ */
+static void
+_stats_windows_dump(FILE *stream)
+{
+  unsigned int windows_nb = 0, damage_nb = 0, pixmaps_nb = 0;
+  for(unagi_window_t *window = globalconf.windows; window; window = window->next)
+    {
+      windows_nb++;
+
+      if(window->damage != XCB_NONE)
+        damage_nb++;
+
+      if(window->pixmap != XCB_NONE)
+        pixmaps_nb++;
+    }
+
+  const unagi_stats_t *stats = &globalconf.stats;
+
+  fprintf(stream, "windows: %u\n", windows_nb);
+  fprintf(stream, "windows_with_damage: %u\n", damage_nb);
+  fprintf(stream, "windows_with_pixmap: %u\n", pixmaps_nb);
+  fprintf(stream, "damage_created: %" PRIu64 "\n", stats->damage_created);
+  fprintf(stream, "damage_released: %" PRIu64 "\n", stats->damage_released);
+  fprintf(stream, "pixmaps_released: %" PRIu64 "\n", stats->pixmaps_released);
+  fprintf(stream, "pixmaps_named: %" PRIu64 "\n", stats->pixmaps_named);
+  fprintf(stream, "windows_painted_per_frame: %.2f\n",
+          _stats_average((double) stats->windows_painted, stats->frames));
+}
+
+/** Dump all the  statistics as "name: value" lines,  easy to parse by
+ *  scripts
+ *
+ * \param stream Where to write the statistics
+ */
+void
+unagi_stats_dump(FILE *stream)
+{
+  const unagi_stats_t *stats = &globalconf.stats;
+  const double now = ev_time();
+  const double elapsed = now - stats->start_time;
+
+  /* Include the time spent in the current tier so far */
+  unagi_governor_stats_update(now);
+  /* Same for the windows bypassing the compositor */
+  unagi_client_stats_update(now);
+
+  fprintf(stream, "elapsed: %.3f\n", elapsed);
+  fprintf(stream, "startup_ms: %.3f\n", stats->startup_time * 1000);
+  fprintf(stream, "startup_windows: %u\n", stats->startup_windows);
+  fprintf(stream, "frames: %" PRIu64 "\n", stats->frames);
+  fprintf(stream, "frames_per_second: %.2f\n",
+          elapsed > 0 ? (double) stats->frames / elapsed : 0.0);
+  fprintf(stream, "wakeups: %" PRIu64 "\n", stats->wakeups);
+  fprintf(stream, "wakeups_per_second: %.2f\n",
+          elapsed > 0 ? (double) stats->wakeups / elapsed : 0.0);
+  fprintf(stream, "events: %" PRIu64 "\n", stats->events);
+  fprintf(stream, "events_per_second: %.2f\n",
+          elapsed > 0 ? (double) stats->events / elapsed : 0.0);
+  fprintf(stream, "events_coalesced: %" PRIu64 "\n", stats->events_coalesced);
+  fprintf(stream, "events_reader: %s\n", globalconf.threaded_events ? "thread" : "loop");
+  fprintf(stream, "event_read_latency_p50_ms: %u\n",
+          _stats_event_latency_percentile(stats->event_read_latency_histogram, 0.50));
+  fprintf(stream, "event_read_latency_p99_ms: %u\n",
+          _stats_event_latency_percentile(stats->event_read_latency_histogram, 0.99));
+  fprintf(stream, "event_handle_latency_p50_ms: %u\n",
+          _stats_event_latency_percentile(stats->event_handle_latency_histogram, 0.50));
+  fprintf(stream, "event_handle_latency_p99_ms: %u\n",
+          _stats_event_latency_percentile(stats->event_handle_latency_histogram, 0.99));
+  fprintf(stream, "requests_per_frame: %.2f\n",
+          _stats_average((double) stats->requests, stats->frames > 1 ? stats->frames - 1 : 0));
+  fprintf(stream, "paint_time_average_ms: %.3f\n",
+          _stats_average(globalconf.paint_time_sum, globalconf.paint_counter) * 1000);
+  fprintf(stream, "paint_time_p50_ms: %.3f\n", _stats_paint_time_percentile(0.50) * 1000);
+  fprintf(stream, "paint_time_p90_ms: %.3f\n", _stats_paint_time_percentile(0.90) * 1000);
+  fprintf(stream, "paint_time_p99_ms: %.3f\n", _stats_paint_time_percentile(0.99) * 1000);
+  fprintf(stream, "paint_time_max_ms: %.3f\n", stats->paint_time_max * 1000);
+  fprintf(stream, "frame_sync_mode: %s\n",
+          globalconf.frames.mode == UNAGI_FRAME_SYNC_FENCE ? "fence" : "sequence");
+  fprintf(stream, "frames_throttled: %" PRIu64 "\n", stats->frames_throttled);
+  fprintf(stream, "throttle_wait_ms: %.3f\n", stats->throttle_wait_time * 1000);
+  fprintf(stream, "server_lag_average_ms: %.3f\n",
+          _stats_average(stats->server_lag_sum, stats->server_lag_count) * 1000);
+  fprintf(stream, "server_lag_max_ms: %.3f\n", stats->server_lag_max * 1000);
+  fprintf(stream, "fence_stalls: %" PRIu64 "\n", stats->fence_stalls);
+  fprintf(stream, "present: %s\n", globalconf.paint_thread ? "thread" : "loop");
+  fprintf(stream, "present_waits: %" PRIu64 "\n", stats->present_waits);
+  fprintf(stream, "present_wait_ms: %.3f\n", stats->present_wait_time * 1000);
+  fprintf(stream, "outputs_suspensions: %" PRIu64 "\n", stats->outputs_suspensions);
+  fprintf(stream, "outputs_suspended_ms: %.3f\n", stats->outputs_suspended_time * 1000);
+  fprintf(stream, "background_rate: %u\n", globalconf.background_rate);
+  fprintf(stream, "background_deferred: %" PRIu64 "\n", stats->background_deferred);
+  fprintf(stream, "background_flushes: %" PRIu64 "\n", stats->background_flushes);
+  fprintf(stream, "frames_immediate: %" PRIu64 "\n", stats->frames_immediate);
+  fprintf(stream, "governor_tier: %s\n",
+          unagi_governor_get_tier_label(unagi_governor_get_tier()));
+  fprintf(stream, "governor_degradations: %" PRIu64 "\n", stats->governor_degradations);
+  fprintf(stream, "governor_restorations: %" PRIu64 "\n", stats->governor_restorations);
+  for(unsigned int tier = 0; tier < UNAGI_GOVERNOR_TIERS_NB; tier++)
+    fprintf(stream, "governor_%s_ms: %.3f\n", unagi_governor_get_tier_label(tier),
+            stats->governor_tier_time[tier] * 1000);
+  fprintf(stream, "bypass_unredirections: %" PRIu64 "\n", stats->bypass_unredirections);
+  fprintf(stream, "bypass_unredirected_ms: %.3f\n", stats->bypass_time * 1000);
+  fprintf(stream, "frames_drawn_reported: %" PRIu64 "\n", stats->frames_drawn_reported);
+  fprintf(stream, "resizes_deferred: %" PRIu64 "\n", stats->resizes_deferred);
+  fprintf(stream, "resizes_synced: %" PRIu64 "\n", stats->resizes_synced);
+  fprintf(stream, "property_requests: %" PRIu64 "\n", stats->property_requests);
+  fprintf(stream, "property_hits: %" PRIu64 "\n", stats->property_hits);
+
+  _stats_windows_dump(stream);
+
+  if(stats->protocol_enabled)
+    _stats_protocol_dump(stream);
+
+  fflush(stream);
+}
@@ -24,12 +24,22 @@
 #include "structs.h"
 #include "display.h"
 #include "event.h"
+#include "event_reader.h"
+#include "paint_thread.h"
+#include "output.h"
+#include "rate.h"
+#include "governor.h"
+#include "client.h"
+#include "property.h"
 #include "atoms.h"
 #include "util.h"
 #include "plugin.h"
 #include "key.h"
 #include "vsync.h"
+#include "frame.h"
+#include "stats.h"
 #include "config.h"
+#include "protocol.h"
 
 unagi_conf_t globalconf;
 
@@ -41,7 +51,28 @@ static inline void display_help(void)
     -o, --opacity             turn on opacity (default off)\n\
     -d, --drm                 use libdrm for vsync\n\
     -g, --opengl              use opengl for vsync\n\
-    -k, --vulkan              use vulkan for vsync\n");
+    -k, --vulkan              use vulkan for vsync\n\
+    -f, --frame-sync=MODE     track frames with 'sequence' numbers (default)\n\
+                              or SYNC 'fence's\n\
+    -n, --frames-in-flight=N  frames the X server may lag behind (default 1)\n\
+    -s, --stats               account X requests and dump statistics on\n\
+                              exit (and on SIGUSR1)\n\
+    -D, --direct              paint directly on the overlay window, without\n\
+                              any buffer\n\
+    -P, --paint-thread        present frames from a dedicated thread with\n\
+                              its own X connection (needs SYNC 3.1)\n\
+    -r, --rendering-dir=DIR/  rendering backends directory (default\n\
+                              " RENDERING_DIR ")\n\
+    -p, --plugins-dir=DIR/    plugins directory (default " PLUGINS_DIR ")\n\
+    -t, --threaded-events     read X events from a dedicated thread\n\
+    -b, --background-rate=HZ  paint windows which are not focused nor\n\
+                              fullscreen at most HZ times per second\n\
+                              (default full rate)\n\
+    -G, --no-governor         never degrade painting quality when frames\n\
+                              take longer than the refresh interval\n\
+    -l, --low-latency         paint the damage of the focused fullscreen\n\
+                              window right away, without waiting for\n\
+                              VBlank (tearing allowed)\n");
     exit(EXIT_SUCCESS);
 }
 
@@ -53,11 +84,22 @@ static void parse_command_line_parameters(int argc, char **argv) {
         { "drm", 0, NULL, 'd' },
         { "opengl", 0, NULL, 'g' },
         { "vulkan", 0, NULL, 'k' },
+        { "frame-sync", 1, NULL, 'f' },
+        { "frames-in-flight", 1, NULL, 'n' },
+        { "stats", 0, NULL, 's' },
+        { "direct", 0, NULL, 'D' },
+        { "rendering-dir", 1, NULL, 'r' },
+        { "plugins-dir", 1, NULL, 'p' },
+        { "threaded-events", 0, NULL, 't' },
+        { "paint-thread", 0, NULL, 'P' },
+        { "background-rate", 1, NULL, 'b' },
+        { "no-governor", 0, NULL, 'G' },
+        { "low-latency", 0, NULL, 'l' },
         { NULL, 0, NULL, 0 }
     };
 
     int opt;
-    while((opt = getopt_long(argc, argv, "hvodgk:", long_options, NULL)) != -1) {
+    while((opt = getopt_long(argc, argv, "hvodgk:f:n:sDr:p:tPb:Gl", long_options, NULL)) != -1) {
         switch(opt) {
         case 'h':
             display_help();
@@ -77,6 +119,44 @@ static void parse_command_line_parameters(int argc, char **argv) {
         case 'k':
             globalconf.vsync_vulkan = true;
         break;
+        case 'f':
+            if(strcmp(optarg, "fence") == 0)
+                globalconf.frames.mode = UNAGI_FRAME_SYNC_FENCE;
+            else if(strcmp(optarg, "sequence") == 0)
+                globalconf.frames.mode = UNAGI_FRAME_SYNC_SEQUENCE;
+            else
+                display_help();
+        break;
+        case 'n':
+            globalconf.frames.max_len = (unsigned int) strtoul(optarg, NULL, 10);
+        break;
+        case 's':
+            globalconf.stats_on_exit = true;
+        break;
+        case 'D':
+            globalconf.paint_direct = true;
+        break;
+        case 'r':
+            globalconf.rendering_dir = strdup(optarg);
+        break;
+        case 'p':
+            globalconf.plugins_dir = strdup(optarg);
+        break;
+        case 't':
+            globalconf.threaded_events = true;
+        break;
+        case 'P':
+            globalconf.paint_thread = true;
+        break;
+        case 'b':
+            globalconf.background_rate = (unsigned int) strtoul(optarg, NULL, 10);
+        break;
+        case 'G':
+            globalconf.governor_disabled = true;
+        break;
+        case 'l':
+            globalconf.low_latency = true;
+        break;
         default:
             display_help();
         break;
@@ -96,8 +176,19 @@ static void parse_command_line_parameters(int argc, char **argv) {
 static void exit_cleanup(void) {
     unagi_debug("Cleaning resources up");
 
+    if(globalconf.stats_on_exit)
+        unagi_stats_dump(stderr);
+
+    unagi_event_reader_stop();
+    unagi_paint_thread_stop();
+
     unagi_plugin_unload_all();
     unagi_window_list_cleanup();
+    unagi_property_cleanup();
+    unagi_atoms_cleanup();
+    unagi_output_cleanup();
+    unagi_rate_cleanup();
+    unagi_client_cleanup();
     unagi_rendering_unload();
 
     xcb_key_symbols_free(globalconf.keysyms);
@@ -107,6 +198,7 @@ static void exit_cleanup(void) {
         free(globalconf.crtc[i]);
 
     free(globalconf.crtc);
+    free(globalconf.damaged_rectangles.rectangles);
     free(globalconf.rendering_dir);
     free(globalconf.plugins_dir);
 
@@ -115,6 +207,7 @@ static void exit_cleanup(void) {
         if(globalconf.cm_window != XCB_NONE)
             xcb_destroy_window(globalconf.connection, globalconf.cm_window);
 
+        unagi_frame_cleanup();
 
         xcb_aux_sync(globalconf.connection);
         xcb_disconnect(globalconf.connection);
@@ -128,12 +221,179 @@ static void exit_on_signal(struct ev_loop *loop, ev_signal *w, int revents) {
   ev_break(loop, EVBREAK_ALL);
 }
 
+static void dump_stats_on_signal(struct ev_loop *loop, ev_signal *w, int revents) {
+    unagi_stats_dump(stderr);
+}
+
+/** Release the resources of windows unmapped for a while
+ *
+ * \see unagi_window_release_unmapped
+ */
+static void
+_unagi_release_callback(EV_P_ ev_timer *w, int revents)
+{
+  if(!unagi_window_release_unmapped(ev_now(EV_A)))
+    ev_timer_stop(EV_A_ w);
+}
+
+/** Check whether there is anything to paint, or windows whose replies
+ *  are awaited which may have to be painted
+ *
+ * \return true if the paint timer must be armed
+ */
+static inline bool
+_unagi_paint_is_needed(void)
+{
+  return (globalconf.damaged || globalconf.damaged_rectangles.len ||
+          globalconf.force_repaint || globalconf.windows_pending ||
+          unagi_client_is_frame_pending());
+}
+
+/** Arm the one-shot paint timer, if not already armed and there is
+ *  anything to paint, on the first slot following the refresh rate
+ *  since the last painting, thus painting stays aligned on VBlank but
+ *  the loop is not woken up at all when nothing is damaged.  Immediate
+ *  frames (low-latency mode) are painted right away instead
+ */
+static void
+_unagi_paint_schedule(void)
+{
+  /* Damage is still tracked but only painted once outputs are back on */
+  if(unagi_output_is_suspended())
+    {
+      if(globalconf.extensions.dpms &&
+         !ev_is_active(&globalconf.event_output_timer_watcher))
+        ev_timer_again(globalconf.event_loop, &globalconf.event_output_timer_watcher);
+
+      return;
+    }
+
+  if(ev_is_active(&globalconf.event_output_timer_watcher))
+    ev_timer_stop(globalconf.event_loop, &globalconf.event_output_timer_watcher);
+
+  if(ev_is_active(&globalconf.event_paint_timer_watcher))
+    {
+      if(!globalconf.paint_immediate)
+        return;
+
+      /* Armed again to fire right away */
+      ev_timer_stop(globalconf.event_loop, &globalconf.event_paint_timer_watcher);
+    }
+
+  const ev_tstamp now = ev_now(globalconf.event_loop);
+
+  /* Otherwise, only the deferred damage of background windows has to
+     be painted, not before their next flush */
+  ev_tstamp min_time = now;
+  if(!_unagi_paint_is_needed())
+    {
+      min_time = unagi_rate_next_flush_time();
+
+      /* Or resized windows if their client does not draw in time */
+      const ev_tstamp resize_time = unagi_client_next_resize_time();
+      if(resize_time && (!min_time || resize_time < min_time))
+        min_time = resize_time;
+
+      if(!min_time)
+        return;
+    }
+
+  ev_tstamp next_time = globalconf.paint_next_time;
+
+  /* Damage of the focused fullscreen window does not wait for the next
+     slot in low-latency mode */
+  if(globalconf.paint_immediate)
+    next_time = now;
+  else if(next_time < min_time)
+    next_time += globalconf.refresh_rate_interval *
+      (ev_tstamp) (unsigned long) ((min_time - next_time) /
+                                   globalconf.refresh_rate_interval + 1);
+
+  ev_timer_set(&globalconf.event_paint_timer_watcher, next_time - now, 0.);
+  ev_timer_start(globalconf.event_loop, &globalconf.event_paint_timer_watcher);
+}
+
+/** Handle the events which may have been queued by XCB while polling a
+ *  reply (and thus not reported on the X connection file descriptor),
+ *  it never blocks
+ */
+static inline void
+_unagi_handle_queued_events(void)
+{
+  ev_invoke(globalconf.event_loop, &globalconf.event_io_watcher, 0);
+}
+
+/** Check the  DPMS state while painting  is suspended, as it does not
+ *  report its changes
+ *
+ * \see unagi_output_dpms_check
+ */
+static void
+_unagi_output_callback(EV_P_ ev_timer *w, int revents)
+{
+  unagi_output_dpms_check(ev_now(EV_A));
+  xcb_flush(globalconf.connection);
+
+  _unagi_handle_queued_events();
+  _unagi_paint_schedule();
+}
+
+/** Count the event loop wakeups, called after each loop iteration */
+static void
+_unagi_wakeup_callback(EV_P_ ev_check *w, int revents)
+{
+  globalconf.stats.wakeups++;
+}
+
 static void
 _unagi_paint_callback(EV_P_ ev_timer *w, int revents)
 {
-  for(unagi_plugin_t *plugin = globalconf.plugins; plugin; plugin = plugin->next)
-    if(plugin->enable && plugin->vtable->activated && plugin->vtable->pre_paint)
-      (*plugin->vtable->pre_paint)();
+  UNAGI_PLUGINS_HOOK_CALL(pre_paint);
+
+  /* Windows whose attributes have been received since can be painted */
+  unagi_window_collect_pending();
+
+  /* Background windows not painted for long enough */
+  unagi_rate_flush(ev_now(EV_A));
+
+  /* Resized windows whose client did not draw in time */
+  unagi_client_resize_flush(ev_now(EV_A));
+
+  /* Painting is suspended once all outputs are known to be off */
+  unagi_output_dpms_check(ev_now(EV_A));
+  if(unagi_output_is_suspended())
+    {
+      /* Nothing is presented, thus not right away either */
+      globalconf.paint_immediate = false;
+
+      xcb_flush(globalconf.connection);
+      _unagi_handle_queued_events();
+      _unagi_paint_schedule();
+      return;
+    }
+
+  /* Nothing is painted while the topmost window bypasses the compositor,
+     but its frames are still reported as drawn */
+  unagi_property_collect();
+  unagi_client_collect();
+  if(unagi_client_update_bypass())
+    {
+      globalconf.paint_immediate = false;
+
+      unagi_client_frames_drawn();
+      xcb_flush(globalconf.connection);
+      _unagi_handle_queued_events();
+      _unagi_paint_schedule();
+      return;
+    }
+
+  /* Send the damaged rectangles accumulated since the last painting,
+     including the windows whose resize has just been applied */
+  unagi_display_flush_damaged();
+
+  /* Do not paint what is not shown by any output */
+  if(!globalconf.force_repaint)
+    unagi_output_clip_damaged();
 
   /* Now paint the windows */
   if(globalconf.damaged || globalconf.force_repaint)
@@ -141,14 +401,19 @@ _unagi_paint_callback(EV_P_ ev_timer *w, int revents)
       if(globalconf.force_repaint)
         unagi_display_reset_damaged();
 
-      unagi_window_paint_all(globalconf.windows);
+      unagi_window_paint_all();
       if(!globalconf.force_repaint)
         unagi_display_reset_damaged();
 
       const float paint_time = (float) (ev_time() - ev_now(globalconf.event_loop));
+      unagi_stats_paint_time(paint_time);
 
       if(!globalconf.force_repaint)
         {
+          /* Degrade painting quality rather than only latency when over
+             budget (forced repaints are not meaningful) */
+          unagi_governor_frame(paint_time, ev_time());
+
           globalconf.paint_time_sum += paint_time;
 
           const float current_average = globalconf.paint_time_sum /
@@ -168,19 +433,47 @@ _unagi_paint_callback(EV_P_ ev_timer *w, int revents)
             globalconf.repaint_interval = current_interval;
         }
 
-      for(unagi_plugin_t *plugin = globalconf.plugins; plugin; plugin = plugin->next)
-        if(plugin->enable && plugin->vtable->activated && plugin->vtable->post_paint)
-          (*plugin->vtable->post_paint)();
+      UNAGI_PLUGINS_HOOK_CALL(post_paint);
 
-      /* Rearm the paint timer watcher */
-      globalconf.event_paint_timer_watcher.repeat = globalconf.repaint_interval;
-      ev_timer_again(globalconf.event_loop, &globalconf.event_paint_timer_watcher);
+      /* The paint timer is only rearmed once something is damaged */
+      globalconf.paint_next_time = ev_now(globalconf.event_loop) +
+        globalconf.repaint_interval;
 
-      /* Some events may have been queued while calling this callback,
-         so make sure by calling this watcher again */
-      ev_invoke(globalconf.event_loop, &globalconf.event_io_watcher, 0);
       globalconf.force_repaint = false;
+
+      if(globalconf.paint_immediate)
+        {
+          globalconf.stats.frames_immediate++;
+          globalconf.paint_immediate = false;
+        }
     }
+
+  /* Clients syncing their frames can draw the next one */
+  unagi_client_frames_drawn();
+
+  /* Some events may have been queued while calling this callback (for
+     instance when polling the replies of frames in flight or of
+     properties), even if nothing has been painted */
+  _unagi_handle_queued_events();
+
+  /* Windows replies may still be awaited */
+  _unagi_paint_schedule();
+}
+
+/** Poll an event from the X connection, accounting when it has been
+ *  read
+ *
+ * \param c The X connection
+ * \return The event or NULL if there is none
+ */
+static xcb_generic_event_t *
+_unagi_poll_for_event(xcb_connection_t *c)
+{
+  xcb_generic_event_t *event = xcb_poll_for_event(c);
+  if(event)
+    unagi_stats_event_read(event, unagi_stats_server_time());
+
+  return event;
 }
 
 static void
@@ -198,30 +491,55 @@ _unagi_io_callback(EV_P_ ev_io *w, int revents)
   if(xcb_connection_has_error(globalconf.connection))
     unagi_fatal("X connection invalid");
 
+  /* The events reader thread, if any, is the only one reading events */
+  xcb_generic_event_t *(*poll_func)(xcb_connection_t *) =
+    globalconf.threaded_events ? unagi_event_reader_pop : _unagi_poll_for_event;
+
   /* Process all events in the queue because before painting, all the
-     DamageNotify have to be received */
-  xcb_generic_event_t *event;
-  while((event = xcb_poll_for_event(globalconf.connection)) != NULL)
+     DamageNotify have to be received. Events are processed by batches
+     so that superseded ones are dropped */
+  while(unagi_event_handle_batch(poll_func) == UNAGI_EVENT_BATCH_MAX)
     {
-      unagi_event_handle(event);
-      free(event);
-
       /* Stop processing events (but not  on startup as all the events
          must be processed) if the  repaint interval has been reached,
          otherwise DamageNotify  keep being processed forever  if many
          are received */
       if(revents != -1 && (ev_time() - now + 0.001) > globalconf.repaint_interval)
         {
-          /* Process events remaining in the queue without polling the
-             X connection */
-          while((event = xcb_poll_for_queued_event(globalconf.connection)))
-            {
-              unagi_event_handle(event);
-              free(event);
-            }
+          /* The reader thread keeps reading events meanwhile, so handle
+             the ones left after painting */
+          if(globalconf.threaded_events)
+            unagi_event_reader_wakeup();
+
           break;
         }
     }
+
+  /* Process events remaining in the queue without polling the X
+     connection: polling replies  while handling events (e.g. of the
+     windows just added) may have queued more, which the file
+     descriptor does not report */
+  if(!globalconf.threaded_events)
+    while(unagi_event_handle_batch(xcb_poll_for_queued_event))
+      ;
+
+  _unagi_paint_schedule();
+}
+
+/** Called  in the loop when the events reader thread has pushed events
+ *  (or the X connection has been closed)
+ */
+static void
+_unagi_async_callback(EV_P_ ev_async *w, int revents)
+{
+  _unagi_io_callback(EV_A_ &globalconf.event_io_watcher, revents);
+}
+
+/** Called in the loop when the paint thread has presented frames */
+static void
+_unagi_present_callback(EV_P_ ev_async *w, int revents)
+{
+  unagi_client_frames_presented();
 }
 
 static void init_ev(void) {
@@ -244,6 +562,11 @@ static void init_ev(void) {
     ev_signal_start(globalconf.event_loop, &sigterm);
     ev_unref(globalconf.event_loop);
 
+    /* Dump statistics on request */
+    ev_signal_init(&globalconf.event_stats_signal_watcher, dump_stats_on_signal, SIGUSR1);
+    ev_signal_start(globalconf.event_loop, &globalconf.event_stats_signal_watcher);
+    ev_unref(globalconf.event_loop);
+
     /* Cleanup resources upon normal exit */
     atexit(exit_cleanup);
 }
@@ -277,6 +600,7 @@ int main(int argc, char **argv) {
 
     parse_command_line_parameters(argc, argv);
     init_ev();
+    unagi_stats_init();
     compositor_connect();
 
     if(globalconf.vsync){
@@ -323,9 +647,20 @@ int main(int argc, char **argv) {
   
     /* Check  extensions  version   and  finish  initialisation  of  the rendering backend */
     unagi_display_init_extensions_finalise();
+
+    /* Before the rendering backend creates its buffers */
+    unagi_paint_thread_init();
+    if(globalconf.paint_thread) {
+        ev_async_init(&globalconf.event_present_watcher, _unagi_present_callback);
+        ev_async_start(globalconf.event_loop, &globalconf.event_present_watcher);
+    }
+
     if(!(*globalconf.rendering->init_finalise)())
         return EXIT_FAILURE;
 
+    /* Set up frames tracking now that SYNC version is known */
+    unagi_frame_init();
+
     xcb_randr_get_screen_info_cookie_t randr_screen_info_cookie = { .sequence = 0 };
     xcb_randr_get_screen_resources_cookie_t randr_screen_resources_cookie = { .sequence = 0 };
     if(globalconf.extensions.randr) {
@@ -333,7 +668,10 @@ int main(int argc, char **argv) {
          painting */
         randr_screen_info_cookie = xcb_randr_get_screen_info_unchecked(globalconf.connection, globalconf.screen->root);
         randr_screen_resources_cookie = xcb_randr_get_screen_resources_unchecked(globalconf.connection, globalconf.screen->root);
-        xcb_randr_select_input(globalconf.connection, globalconf.screen->root, XCB_RANDR_NOTIFY_MASK_SCREEN_CHANGE);
+        xcb_randr_select_input(globalconf.connection, globalconf.screen->root,
+                               XCB_RANDR_NOTIFY_MASK_SCREEN_CHANGE |
+                               (globalconf.extensions.randr_crtc_notify ?
+                                XCB_RANDR_NOTIFY_MASK_CRTC_CHANGE : 0));
     }
 
   /* Validate  errors   and  get  PropertyNotify   needed  to  acquire
@@ -359,17 +697,26 @@ int main(int argc, char **argv) {
     /* Now redirect windows and add existing windows */
     unagi_display_init_redirect();
 
-    /* Validate errors handlers during redirect */
-    xcb_aux_sync(globalconf.connection);
-    unagi_event_handle_poll_loop(unagi_event_handle_startup);
-
-    /* Manage existing windows */
+    /* Send requests to manage existing windows */
     unagi_display_init_redirect_finalise();
 
+    /* Validate errors handlers during redirect (received before the
+       QueryTree reply) */
+    unagi_event_handle_poll_loop(unagi_event_handle_startup);
+
+    /* The requests about existing windows are processed before the
+       server is ungrabbed, so there is no need to keep other clients
+       waiting while collecting their replies */
     xcb_ungrab_server(globalconf.connection);
+    xcb_flush(globalconf.connection);
+
+    unagi_window_manage_existing_finalise();
 
     unagi_plugin_check_requirements();
 
+    /* Start tracking the active window */
+    unagi_rate_init();
+
     globalconf.repaint_interval = globalconf.refresh_rate_interval;
 
     /* Initialise painting timer depending on the screen refresh rate */
@@ -378,10 +725,18 @@ int main(int argc, char **argv) {
     /* Painting must have precedence over events processing */
     ev_set_priority(&globalconf.event_paint_timer_watcher, EV_MAXPRI);
 
-    /* Set the initial repaint interval to the screen refresh rate, it
-       will be adjust later on according to the repaint times */
-    globalconf.event_paint_timer_watcher.repeat = globalconf.repaint_interval;
-    ev_timer_again(globalconf.event_loop, &globalconf.event_paint_timer_watcher);
+    /* Count wakeups, to check that the loop sleeps when idle */
+    ev_check_init(&globalconf.event_wakeup_check_watcher, _unagi_wakeup_callback);
+    ev_check_start(globalconf.event_loop, &globalconf.event_wakeup_check_watcher);
+    ev_unref(globalconf.event_loop);
+
+    /* Only started when all outputs are off */
+    ev_init(&globalconf.event_output_timer_watcher, _unagi_output_callback);
+    globalconf.event_output_timer_watcher.repeat = UNAGI_OUTPUT_DPMS_CHECK_INTERVAL;
+
+    /* Only started when a window is unmapped */
+    ev_init(&globalconf.event_release_timer_watcher, _unagi_release_callback);
+    globalconf.event_release_timer_watcher.repeat = UNAGI_WINDOW_RELEASE_DELAY;
  
     /* Get the lock masks reply of the request previously sent */ 
     unagi_key_lock_mask_get_reply(key_mapping_cookie);
@@ -390,7 +745,26 @@ int main(int argc, char **argv) {
        may have been received in the meantime */
     xcb_flush(globalconf.connection);
 
-    unagi_window_paint_all(globalconf.windows);
+    unagi_window_paint_all();
+    globalconf.stats.startup_time = ev_time() - globalconf.stats.start_time;
+
+    /* The repaint interval is adjusted later on according to the repaint
+       times, the paint timer being armed when something is damaged */
+    ev_now_update(globalconf.event_loop);
+    globalconf.paint_next_time = ev_now(globalconf.event_loop) +
+      globalconf.repaint_interval;
+
+    /* From now on, events are only read by a dedicated thread, which
+       wakes the loop up, so that they are read even while painting */
+    if(globalconf.threaded_events) {
+        ev_io_stop(globalconf.event_loop, &globalconf.event_io_watcher);
+
+        ev_async_init(&globalconf.event_async_watcher, _unagi_async_callback);
+        ev_async_start(globalconf.event_loop, &globalconf.event_async_watcher);
+
+        unagi_event_reader_start();
+    }
+
     ev_invoke(globalconf.event_loop, &globalconf.event_io_watcher, -1);
 
     /* Main event and error loop */
@@ -398,6 +772,10 @@ int main(int argc, char **argv) {
 
     ev_io_stop(globalconf.event_loop, &globalconf.event_io_watcher);
     ev_timer_stop(globalconf.event_loop, &globalconf.event_paint_timer_watcher);
+    ev_timer_stop(globalconf.event_loop, &globalconf.event_release_timer_watcher);
+    ev_timer_stop(globalconf.event_loop, &globalconf.event_output_timer_watcher);
+    ev_ref(globalconf.event_loop);
+    ev_check_stop(globalconf.event_loop, &globalconf.event_wakeup_check_watcher);
 
     return EXIT_SUCCESS;
 }
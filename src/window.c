@@ -7,14 +7,18 @@
 #include <xcb/xcb.h>
 #include <xcb/xproto.h>
 #include <xcb/composite.h>
-
-#include <xcb/xcb_aux.h>
+#include <xcb/shape.h>
 
 #include "window.h"
 #include "structs.h"
 #include "atoms.h"
 #include "display.h"
 #include "vsync.h"
+#include "frame.h"
+#include "rate.h"
+#include "client.h"
+#include "property.h"
+#include "protocol.h"
 
 /** Append a window to the end  of the windows list which is organized
  *  from the bottommost to the topmost window
@@ -28,6 +32,7 @@ window_list_append(const xcb_window_t new_window_id)
   unagi_window_t *new_window = calloc(1, sizeof(unagi_window_t));
 
   new_window->id = new_window_id;
+  new_window->is_rectangular = true;
   new_window->prev = NULL;
   new_window->next = NULL;
 
@@ -51,6 +56,63 @@ window_list_append(const xcb_window_t new_window_id)
   return new_window;
 }
 
+/** Remove a window from the list of windows whose replies are still
+ *  awaited, and discard these replies
+ *
+ * \param window The window object
+ */
+static void
+window_pending_remove(unagi_window_t *window)
+{
+  if(window->attributes_cookie.sequence)
+    xcb_discard_reply(globalconf.connection, window->attributes_cookie.sequence);
+
+  if(window->geometry_cookie.sequence)
+    xcb_discard_reply(globalconf.connection, window->geometry_cookie.sequence);
+
+  window->attributes_cookie.sequence = 0;
+  window->geometry_cookie.sequence = 0;
+
+  free(window->pending_attributes);
+  window->pending_attributes = NULL;
+
+  unagi_window_t *prev = NULL;
+  for(unagi_window_t *w = globalconf.windows_pending; w; prev = w, w = w->pending_next)
+    if(w == window)
+      {
+        if(prev)
+          prev->pending_next = window->pending_next;
+        else
+          globalconf.windows_pending = window->pending_next;
+
+        if(globalconf.windows_pending_tail == window)
+          globalconf.windows_pending_tail = prev;
+
+        break;
+      }
+
+  window->pending_next = NULL;
+  window->is_pending = false;
+}
+
+/** Remove a window from the dirty list
+ *
+ * \param window The window object
+ */
+static void
+window_dirty_remove(unagi_window_t *window)
+{
+  for(unagi_window_t **w = &globalconf.windows_dirty; *w; w = &(*w)->dirty_next)
+    if(*w == window)
+      {
+        *w = window->dirty_next;
+        break;
+      }
+
+  window->dirty_next = NULL;
+  window->is_dirty = false;
+}
+
 /** Free a given window and its associated resources
  *
  * \param window The window object to be freed
@@ -76,6 +138,21 @@ window_list_free_window(unagi_window_t *window, bool do_itree_remove)
       window->region = XCB_NONE;
     }
 
+  if(window->shape_cookie.sequence)
+    xcb_discard_reply(globalconf.connection, window->shape_cookie.sequence);
+
+  free(window->shape_rectangles);
+
+  if(window->is_pending)
+    window_pending_remove(window);
+
+  if(window->is_dirty)
+    window_dirty_remove(window);
+
+  unagi_rate_window_remove(window);
+  unagi_client_window_free(window);
+  unagi_property_window_remove(window->id);
+
   /* TODO: free plugins memory? */
   unagi_window_free_pixmap(window);
   (*globalconf.rendering->free_window)(window);
@@ -108,6 +185,8 @@ unagi_window_list_remove_window(unagi_window_t *window, bool do_delete)
   if(globalconf.windows_tail == window)
     globalconf.windows_tail = window->prev;
 
+  globalconf.windows_painted.is_outdated = true;
+
   if(do_delete)
     window_list_free_window(window, true);
 }
@@ -132,6 +211,8 @@ unagi_window_list_cleanup(void)
       window_list_free_window(window, false);
       window = window_next;
     }
+
+  free(globalconf.windows_painted.windows);
 }
 
 /** Free  a  Window Pixmap  which  has  been  previously allocated  by
@@ -153,6 +234,91 @@ unagi_window_free_pixmap(unagi_window_t *window)
     }
 }
 
+/** Associate a  Damage object to the  window, unless this is an
+ *  InputOnly window as nothing will never be painted in it.  This is
+ *  only done once the window is viewable and on the screen, as many
+ *  windows are never mapped.  The error of DamageCreate, if any (the
+ *  window may have been destroyed in the meantime),  is reported to
+ *  the error handler rather than waited for
+ *
+ * \see event_handle_error
+ * \param window The window object
+ */
+void
+unagi_window_create_damage(unagi_window_t *window)
+{
+  if(window->damage != XCB_NONE ||
+     window->attributes->_class == XCB_WINDOW_CLASS_INPUT_ONLY)
+    return;
+
+  window->damage = xcb_generate_id(globalconf.connection);
+
+  /* With DamageReportRawRectangles level, no attempt to compress
+     out overlapping rectangles is made, therefore many events are
+     received and handled needlessly, whereas with DamageReportNonEmpty
+     level only a single event specifying the full window region is sent
+     thus this is not efficient for small damage regions */
+  xcb_damage_create(globalconf.connection, window->damage, window->id,
+                    XCB_DAMAGE_REPORT_LEVEL_DELTA_RECTANGLES);
+
+  globalconf.stats.damage_created++;
+
+  /* Its hints may have changed while it was unmapped */
+  unagi_client_manage(window);
+
+  /* The window content drawn before is not reported by DamageNotify */
+  unagi_window_add_damaged(window);
+  window->damaged = true;
+  window->damaged_ratio = 1.0;
+  unagi_window_set_dirty(window);
+  globalconf.windows_painted.is_outdated = true;
+}
+
+/** Release the Damage object and  Pixmap of windows unmapped for more
+ *  than UNAGI_WINDOW_RELEASE_DELAY, they are created again when the
+ *  window is mapped
+ *
+ * \param now The current time
+ * \return true if unmapped windows still hold them
+ */
+bool
+unagi_window_release_unmapped(const double now)
+{
+  bool is_releasable = false;
+
+  for(unagi_window_t *window = globalconf.windows; window; window = window->next)
+    {
+      if(!window->attributes ||
+         window->attributes->map_state == XCB_MAP_STATE_VIEWABLE ||
+         (window->damage == XCB_NONE && window->pixmap == XCB_NONE))
+        continue;
+
+      if(now - window->unmap_time < UNAGI_WINDOW_RELEASE_DELAY)
+        {
+          is_releasable = true;
+          continue;
+        }
+
+      unagi_debug("Releasing resources of unmapped window %jx",
+                  (uintmax_t) window->id);
+
+      if(window->damage != XCB_NONE)
+        {
+          xcb_damage_destroy(globalconf.connection, window->damage);
+          window->damage = XCB_NONE;
+          globalconf.stats.damage_released++;
+        }
+
+      if(window->pixmap != XCB_NONE)
+        {
+          unagi_window_free_pixmap(window);
+          globalconf.stats.pixmaps_released++;
+        }
+    }
+
+  return is_releasable;
+}
+
 /** Send ChangeWindowAttributes request in order to get events related
  *  to a window
  *
@@ -168,11 +334,9 @@ unagi_window_register_notify(const unagi_window_t *window)
 			       XCB_CW_EVENT_MASK, &select_input_val);
 }
 
-/* TODO: Need to figure out a better way to do (not thread-safe!) */
-static xcb_get_property_cookie_t root_background_cookies[2];
-
 /* Get  the root window  background pixmap  whose identifier  is given
- * usually by either XROOTPMAP_ID or UNAGI__XSETROOT_ID Property Atoms
+ * usually by either XROOTPMAP_ID or UNAGI__XSETROOT_ID Property Atoms,
+ * which are only fetched if not cached yet
  */
 void
 unagi_window_get_root_background_pixmap(void)
@@ -180,14 +344,8 @@ unagi_window_get_root_background_pixmap(void)
   for(uint8_t background_property_n = 0;
       unagi_background_properties_atoms[background_property_n];
       background_property_n++)
-    {
-      root_background_cookies[background_property_n] =
-	xcb_get_property_unchecked(globalconf.connection, false,
-				   globalconf.screen->root,
-				   *unagi_background_properties_atoms[background_property_n],
-				   XCB_GET_PROPERTY_TYPE_ANY,
-				   0, 4);
-    }
+    unagi_property_prefetch(globalconf.screen->root, 1,
+                            unagi_background_properties_atoms[background_property_n]);
 }
 
 /** Get the  first Property  whose reply is  valid and get  the stored
@@ -199,18 +357,15 @@ xcb_pixmap_t
 unagi_window_get_root_background_pixmap_finalise(void)
 {
   xcb_pixmap_t root_background_pixmap = XCB_NONE;
-  xcb_get_property_reply_t *root_property_reply;
+  const xcb_get_property_reply_t *root_property_reply;
 
   for(uint8_t background_property_n = 0;
       unagi_background_properties_atoms[background_property_n];
       background_property_n++)
     {
-      assert(root_background_cookies[background_property_n].sequence);
-
       root_property_reply =
-	xcb_get_property_reply(globalconf.connection,
-			       root_background_cookies[background_property_n],
-			       NULL);
+        unagi_property_get(globalconf.screen->root,
+                           *unagi_background_properties_atoms[background_property_n]);
 
       if(root_property_reply && root_property_reply->type == XCB_ATOM_PIXMAP &&
 	 (xcb_get_property_value_length(root_property_reply)) == 4)
@@ -218,12 +373,9 @@ unagi_window_get_root_background_pixmap_finalise(void)
 	  memcpy(&root_background_pixmap,
 		 xcb_get_property_value(root_property_reply), 4);
 
-	  free(root_property_reply);
 	  break;
 	}
 
-      free(root_property_reply);
-
       unagi_debug("Can't get such property for the root window");
     }
 
@@ -249,13 +401,14 @@ unagi_window_new_root_background_pixmap(void)
 /** Get  the Pixmap  associated with  the  given Window  by sending  a
  *  NameWindowPixmap Composite  request. Must be careful  when to free
  *  this Pixmap, because  a new one is generated  each time the window
- *  is mapped or resized
+ *  is mapped or resized.  Its size is recorded, as the window may be
+ *  resized again before the next one is named
  *
  * \param window The window object
  * \return The Pixmap associated with the Window
  */
 xcb_pixmap_t
-unagi_window_get_pixmap(const unagi_window_t *window)
+unagi_window_get_pixmap(unagi_window_t *window)
 {
   /* Update the pixmap thanks to CompositeNameWindowPixmap */
   xcb_pixmap_t pixmap = xcb_generate_id(globalconf.connection);
@@ -264,11 +417,56 @@ unagi_window_get_pixmap(const unagi_window_t *window)
 				   window->id,
 				   pixmap);
 
+  window->pixmap_width = window_width_with_border(window->geometry);
+  window->pixmap_height = window_height_with_border(window->geometry);
+
+  globalconf.stats.pixmaps_named++;
   return pixmap;
 }
 
+/** Update the cached shape of the window from a GetRectangles reply
+ *
+ * \param window The window object
+ * \param reply The GetRectangles reply (may be NULL)
+ */
+static void
+window_update_shape(unagi_window_t *window,
+                    xcb_shape_get_rectangles_reply_t *reply)
+{
+  /* The window may have been destroyed in the meantime */
+  if(!reply || !window->geometry)
+    return;
+
+  const int rectangles_len = xcb_shape_get_rectangles_rectangles_length(reply);
+  const xcb_rectangle_t *rectangles = xcb_shape_get_rectangles_rectangles(reply);
+
+  /* The  bounding shape  of an unshaped window  is a  single rectangle
+     covering the window and its border */
+  const int16_t border_width = (int16_t) window->geometry->border_width;
+  if(rectangles_len == 1 &&
+     rectangles[0].x == -border_width && rectangles[0].y == -border_width &&
+     rectangles[0].width == window_width_with_border(window->geometry) &&
+     rectangles[0].height == window_height_with_border(window->geometry))
+    {
+      unagi_window_set_unshaped(window);
+      return;
+    }
+
+  window->shape_rectangles = realloc(window->shape_rectangles,
+                                     rectangles_len * sizeof(xcb_rectangle_t));
+
+  memcpy(window->shape_rectangles, rectangles,
+         rectangles_len * sizeof(xcb_rectangle_t));
+
+  window->shape_rectangles_len = (unsigned int) rectangles_len;
+  window->is_rectangular = false;
+  window->is_region_outdated = true;
+  window->shape_serial++;
+}
+
 /** Check whether the given window is rectangular to optimize painting
- *  as most windows are rectangular
+ *  as most windows are rectangular. If the shape has been requested,
+ *  its reply is only waited for now
  *
  * \param window The window object
  * \return True if the window is rectangular
@@ -279,61 +477,124 @@ unagi_window_is_rectangular(unagi_window_t *window)
   if(!window->shape_cookie.sequence)
     return window->is_rectangular;
 
-  xcb_xfixes_fetch_region_reply_t *r =
-    xcb_xfixes_fetch_region_reply(globalconf.connection,
-                                  window->shape_cookie,
-                                  NULL);
-  if(r)
-    {
-      window->is_rectangular = xcb_xfixes_fetch_region_rectangles_length(r) <= 1;
-      free(r);
-    }
-  else
-    window->is_rectangular = true;
+  xcb_shape_get_rectangles_reply_t *reply =
+    xcb_shape_get_rectangles_reply(globalconf.connection,
+                                   window->shape_cookie,
+                                   NULL);
 
   window->shape_cookie.sequence = 0;
+  window_update_shape(window, reply);
+  free(reply);
 
   return window->is_rectangular;
 }
 
-/** No need to include Shape extension header just for that */
-#define XCB_SHAPE_SK_BOUNDING 0
+/** Forget about the  cached shape of a  window which is not shaped
+ *  anymore
+ *
+ * \param window The window object
+ */
+void
+unagi_window_set_unshaped(unagi_window_t *window)
+{
+  if(window->is_rectangular)
+    return;
+
+  free(window->shape_rectangles);
+  window->shape_rectangles = NULL;
+  window->shape_rectangles_len = 0;
+  window->is_rectangular = true;
+  window->is_region_outdated = true;
+  window->shape_serial++;
+}
 
-/** Get   the  region   of  the   given  Window   and  take   care  of
- *  non-rectangular windows by using CreateRegionFromWindow instead of
- *  Window size and position
+/** Request the bounding shape of the window, whose reply is only fetched
+ *  when needed by unagi_window_is_rectangular().  Afterwards,  shape
+ *  changes are notified by ShapeNotify events
  *
  * \param window The window object
- * \return The region associated with the given Window
  */
-xcb_xfixes_region_t
-unagi_window_get_region(unagi_window_t *window, bool screen_relative, bool check_shape)
+void
+unagi_window_check_shape(unagi_window_t *window)
 {
-  xcb_xfixes_region_t new_region = xcb_generate_id(globalconf.connection);
+  if(!globalconf.extensions.shape)
+    return;
 
-  xcb_xfixes_create_region_from_window(globalconf.connection,
-                                       new_region,
-                                       window->id,
-                                       XCB_SHAPE_SK_BOUNDING);
+  if(window->shape_cookie.sequence)
+    xcb_discard_reply(globalconf.connection, window->shape_cookie.sequence);
 
+  window->shape_cookie =
+    xcb_shape_get_rectangles(globalconf.connection, window->id,
+                             XCB_SHAPE_SK_BOUNDING);
+}
 
-  if(screen_relative)
-    xcb_xfixes_translate_region(globalconf.connection,
-                                new_region,
-                                (int16_t) (window->geometry->x +
-                                           window->geometry->border_width),
-                                (int16_t) (window->geometry->y +
-                                           window->geometry->border_width));
+/** Get the screen-relative Region of the window, only created or updated
+ *  when actually needed at painting time, so  that moving or resizing
+ *  a window does  not generate any XFixes request.  The Region is set
+ *  from the window geometry, or its cached shape for shaped windows.
+ *  The Region belongs to the window and must not be destroyed
+ *
+ * \param window The window object
+ * \return The window Region
+ */
+xcb_xfixes_region_t
+unagi_window_get_screen_region(unagi_window_t *window)
+{
+  if(window->region != XCB_NONE && !window->is_region_outdated)
+    return window->region;
 
-  if(check_shape)
+  if(unagi_window_is_rectangular(window))
     {
-      window->shape_cookie = xcb_xfixes_fetch_region_unchecked(globalconf.connection,
-                                                               new_region);
+      xcb_rectangle_t rectangle;
+      unagi_window_get_rectangle(window, &rectangle);
 
-      xcb_flush(globalconf.connection);
+      if(window->region == XCB_NONE)
+        {
+          window->region = xcb_generate_id(globalconf.connection);
+          xcb_xfixes_create_region(globalconf.connection, window->region,
+                                   1, &rectangle);
+        }
+      else
+        xcb_xfixes_set_region(globalconf.connection, window->region,
+                              1, &rectangle);
+    }
+  /* Otherwise, build it from the cached shape */
+  else
+    {
+      if(window->region == XCB_NONE)
+        {
+          window->region = xcb_generate_id(globalconf.connection);
+          xcb_xfixes_create_region(globalconf.connection, window->region,
+                                   window->shape_rectangles_len,
+                                   window->shape_rectangles);
+        }
+      else
+        xcb_xfixes_set_region(globalconf.connection, window->region,
+                              window->shape_rectangles_len,
+                              window->shape_rectangles);
+
+      xcb_xfixes_translate_region(globalconf.connection, window->region,
+                                  (int16_t) (window->geometry->x +
+                                             window->geometry->border_width),
+                                  (int16_t) (window->geometry->y +
+                                             window->geometry->border_width));
     }
 
-  return new_region;
+  window->is_region_outdated = false;
+  return window->region;
+}
+
+/** Add the whole window area to the damaged area, its bounding rectangle
+ *  is enough even for shaped windows and does not require any request
+ *
+ * \param window The window object
+ */
+void
+unagi_window_add_damaged(const unagi_window_t *window)
+{
+  xcb_rectangle_t rectangle;
+  unagi_window_get_rectangle(window, &rectangle);
+  unagi_display_add_damaged_rectangle(&rectangle);
 }
 
 /** Check whether the window is visible within the screen geometry
@@ -344,7 +605,8 @@ unagi_window_get_region(unagi_window_t *window, bool screen_relative, bool check
 bool
 unagi_window_is_visible(const unagi_window_t *window)
 {
-  return (window->attributes &&
+  return (!window->is_pending &&
+          window->attributes &&
           window->attributes->map_state == XCB_MAP_STATE_VIEWABLE &&
           window->geometry &&
 	  window->geometry->x + window->geometry->width >= 1 &&
@@ -353,6 +615,34 @@ unagi_window_is_visible(const unagi_window_t *window)
 	  window->geometry->y < globalconf.screen->height_in_pixels);
 }
 
+/** Check whether a rectangle covers the whole screen
+ *
+ * \param rectangle The screen-relative rectangle
+ * \return true if the rectangle covers the screen
+ */
+bool
+unagi_window_rectangle_covers_screen(const xcb_rectangle_t *rectangle)
+{
+  return (rectangle->x <= 0 && rectangle->y <= 0 &&
+          rectangle->x + rectangle->width >= globalconf.screen->width_in_pixels &&
+          rectangle->y + rectangle->height >= globalconf.screen->height_in_pixels);
+}
+
+/** Check whether the window (including its border) covers the whole
+ *  screen
+ *
+ * \param window The window object
+ * \return true if the window is fullscreen
+ */
+bool
+unagi_window_is_fullscreen(const unagi_window_t *window)
+{
+  xcb_rectangle_t rectangle;
+  unagi_window_get_rectangle(window, &rectangle);
+
+  return unagi_window_rectangle_covers_screen(&rectangle);
+}
+
 /** Send ChangeWindowAttributes  request to set  the override-redirect
  *  flag  on the  given window  to define  whether the  window manager
  *  should take care of the window or not
@@ -408,6 +698,7 @@ typedef struct
 {
   xcb_get_window_attributes_cookie_t attributes;
   xcb_get_geometry_cookie_t geometry;
+  xcb_shape_get_rectangles_cookie_t shape;
 } window_add_requests_cookies_t;
 
 /** Send requests when a window is added (CreateNotify or on startup),
@@ -425,10 +716,24 @@ window_add_requests(const xcb_window_t window_id, bool get_geometry)
   window_add_requests_cookies_t cookies;
   cookies.geometry.sequence = 0;
 
+  /* Errors are returned with the replies rather than as events */
   cookies.attributes = xcb_get_window_attributes(globalconf.connection,
                                                  window_id);
 
-  cookies.geometry = xcb_get_geometry(globalconf.connection, window_id);
+  if(get_geometry)
+    cookies.geometry = xcb_get_geometry(globalconf.connection, window_id);
+
+  cookies.shape.sequence = 0;
+  if(globalconf.extensions.shape)
+    {
+      /* Select ShapeNotify first to not miss any change after getting
+         the current shape */
+      xcb_shape_select_input(globalconf.connection, window_id, true);
+
+      cookies.shape = xcb_shape_get_rectangles(globalconf.connection,
+                                               window_id,
+                                               XCB_SHAPE_SK_BOUNDING);
+    }
 
   return cookies;
 }
@@ -447,6 +752,9 @@ static bool
 window_add_requests_finalise(unagi_window_t * const window,
 			     const window_add_requests_cookies_t window_add_cookies)
 {
+  /* Only fetched when needed, and discarded if the window is freed */
+  window->shape_cookie = window_add_cookies.shape;
+
   window->attributes = xcb_get_window_attributes_reply(globalconf.connection,
 						       window_add_cookies.attributes,
 						       NULL);
@@ -454,33 +762,12 @@ window_add_requests_finalise(unagi_window_t * const window,
   if(!window->attributes)
     {
       unagi_debug("GetWindowAttributes failed for window %jx", (uintmax_t) window->id);
-      return false;
-    }
 
-  /* No  need to create  a Damage  object for  an InputOnly  window as
-     nothing will never be painted in it */
-  if(window->attributes->_class == XCB_WINDOW_CLASS_INPUT_ONLY)
-    window->damage = XCB_NONE;
-  else
-    {
-      window->damage = xcb_generate_id(globalconf.connection);
-
-      /* With DamageReportRawRectangles level, no attempt to compress
-         out overlapping rectangles is made, therefore many events are
-         received and handled needlessly, whereas with DamageReportNonEmpty
-         level only a single event specifying the full window region is sent
-         thus this is not efficient for small damage regions */
-      xcb_generic_error_t *error;
-      if((error = xcb_request_check(globalconf.connection,
-                                    xcb_damage_create_checked(globalconf.connection,
-                                                              window->damage,
-                                                              window->id,
-                                                              XCB_DAMAGE_REPORT_LEVEL_DELTA_RECTANGLES))))
-        {
-          free(error);
-          unagi_debug("DamageCreate failed for window %jx", (uintmax_t) window->id);
-          return false;
-        }
+      if(window_add_cookies.geometry.sequence)
+        xcb_discard_reply(globalconf.connection,
+                          window_add_cookies.geometry.sequence);
+
+      return false;
     }
 
   if(window_add_cookies.geometry.sequence)
@@ -499,10 +786,21 @@ window_add_requests_finalise(unagi_window_t * const window,
   return true;
 }
 
+/** Windows existing on startup whose replies are being collected */
+static struct
+{
+  int nwindows;
+  unagi_window_t **windows;
+  window_add_requests_cookies_t *cookies;
+} _window_manage_existing;
+
 /** Manage  all  existing   windows  and  get  information  (geometry,
  *  attributes and opacity). This function is called on startup to add
- *  existing windows
+ *  existing  windows  and  only  sends  the requests,  so  that  the
+ *  server  can be ungrabbed before  the replies are  collected  (they
+ *  are computed in the requests order anyway)
  *
+ * \see unagi_window_manage_existing_finalise
  * \param nwindows The number of windows to add
  * \param new_windows_id The Windows XIDs
  */
@@ -510,80 +808,222 @@ void
 unagi_window_manage_existing(const int nwindows,
                              const xcb_window_t * const new_windows_id)
 {
-  window_add_requests_cookies_t window_add_cookies[nwindows];
+  _window_manage_existing.nwindows = nwindows;
+  _window_manage_existing.windows = calloc((size_t) nwindows, sizeof(unagi_window_t *));
+  _window_manage_existing.cookies = calloc((size_t) nwindows,
+                                           sizeof(window_add_requests_cookies_t));
 
   for(int nwindow = 0; nwindow < nwindows; ++nwindow)
-    /* Ignore the CM window */
-    if(new_windows_id[nwindow] != globalconf.cm_window)
-      window_add_cookies[nwindow] = window_add_requests(new_windows_id[nwindow],
-                                                        true);
+    /* Ignore the CM window and the overlay Window */
+    if(new_windows_id[nwindow] != globalconf.cm_window &&
+       new_windows_id[nwindow] != globalconf.overlay_window)
+      _window_manage_existing.cookies[nwindow] =
+        window_add_requests(new_windows_id[nwindow], true);
 
   globalconf.windows_itree = util_itree_new();
 
-  unagi_window_t *new_windows[nwindows];
   for(int nwindow = 0; nwindow < nwindows; ++nwindow)
-    new_windows[nwindow] = window_list_append(new_windows_id[nwindow]);
+    _window_manage_existing.windows[nwindow] =
+      window_list_append(new_windows_id[nwindow]);
 
-  for(int nwindow = 0; nwindow < nwindows; ++nwindow)
+  globalconf.stats.startup_windows = (unsigned int) nwindows;
+}
+
+/** Collect the replies  of the requests sent for existing windows, as
+ *  all of them have already been sent, each reply only waits for the
+ *  X server to process one more request rather than a round trip
+ *
+ * \see unagi_window_manage_existing
+ */
+void
+unagi_window_manage_existing_finalise(void)
+{
+  unagi_window_t **new_windows = _window_manage_existing.windows;
+  int nwindows_managed = 0;
+
+  for(int nwindow = 0; nwindow < _window_manage_existing.nwindows; ++nwindow)
     {
-      /* Ignore the CM window */
-      if(new_windows_id[nwindow] == globalconf.cm_window)
+      unagi_window_t *window = new_windows[nwindow];
+
+      /* Ignore the CM window and the overlay Window */
+      if(!_window_manage_existing.cookies[nwindow].attributes.sequence)
 	continue;
 
-      if(!window_add_requests_finalise(new_windows[nwindow],
-					window_add_cookies[nwindow]))
+      if(!window_add_requests_finalise(window,
+					_window_manage_existing.cookies[nwindow]))
 	{
-          unagi_warn("Cannot manage window %jx", (uintmax_t) new_windows_id[nwindow]);
-	  unagi_window_list_remove_window(new_windows[nwindow], true);
+          unagi_warn("Cannot manage window %jx", (uintmax_t) window->id);
+	  unagi_window_list_remove_window(window, true);
 	  continue;
 	}
 
       /* The opacity  property is only  meaningful when the  window is
 	 mapped, because when the window is unmapped, we don't receive
 	 PropertyNotify */
-      if(unagi_window_is_visible(new_windows[nwindow]))
+      if(unagi_window_is_visible(window))
 	{
-	  unagi_window_register_notify(new_windows[nwindow]);
-	  new_windows[nwindow]->pixmap = unagi_window_get_pixmap(new_windows[nwindow]);
-
-          /* Get the Window Region as  well, this is also performed in
-             CreateNotify   and   ConfigureNotify   handler  for   new
-             Windows */
-          new_windows[nwindow]->region = unagi_window_get_region(new_windows[nwindow],
-                                                                 true, true);
+	  unagi_window_register_notify(window);
+	  unagi_property_manage(window);
+	  window->pixmap = unagi_window_get_pixmap(window);
+	  unagi_window_create_damage(window);
 	}
+
+      /* Only give the windows actually managed to plugins */
+      new_windows[nwindows_managed++] = window;
     }
 
   for(unagi_plugin_t *plugin = globalconf.plugins; plugin; plugin = plugin->next)
     if(plugin->vtable->window_manage_existing)
-      (*plugin->vtable->window_manage_existing)(nwindows, new_windows);
+      (*plugin->vtable->window_manage_existing)(nwindows_managed, new_windows);
+
+  free(_window_manage_existing.windows);
+  free(_window_manage_existing.cookies);
+  memset(&_window_manage_existing, 0, sizeof(_window_manage_existing));
 }
 
 /** Add  the  given   window  to  the  windows  list   and  also  send
- *  GetWindowAttributes request  (no need  to split this  function for
- *  now) and GetGeometry if specified
+ *  GetWindowAttributes request and GetGeometry if the geometry is not
+ *  known. As this  is called from  event handlers, the replies are not
+ *  waited  for:  until  they  are received,  the window  has  the state
+ *  given by events and is not considered visible
  *
  * \see window_add_requests
+ * \see unagi_window_collect_pending
  * \param new_window_id The new Window XID
- * \param get_geometry Should GetGeometry request be sent
+ * \param geometry The window geometry if known (owned by the window), or NULL
+ * \param override_redirect The window override-redirect flag
  * \return The new window object
  */
 unagi_window_t *
-window_add(const xcb_window_t new_window_id, bool get_geometry)
+window_add(const xcb_window_t new_window_id, xcb_get_geometry_reply_t *geometry,
+           const uint8_t override_redirect)
 {
   window_add_requests_cookies_t cookies = window_add_requests(new_window_id,
-                                                              get_geometry);
+                                                              geometry == NULL);
 
   unagi_window_t *new_window = window_list_append(new_window_id);
 
-  /* The request should never fail... */
-  if(!window_add_requests_finalise(new_window, cookies))
+  new_window->attributes_cookie = cookies.attributes;
+  new_window->geometry_cookie = cookies.geometry;
+  new_window->shape_cookie = cookies.shape;
+
+  /* A window is always unmapped when created or reparented */
+  new_window->attributes = calloc(1, sizeof(xcb_get_window_attributes_reply_t));
+  new_window->attributes->_class = XCB_WINDOW_CLASS_INPUT_OUTPUT;
+  new_window->attributes->map_state = XCB_MAP_STATE_UNMAPPED;
+  new_window->attributes->override_redirect = override_redirect;
+
+  new_window->geometry = geometry ? geometry :
+    calloc(1, sizeof(xcb_get_geometry_reply_t));
+
+  /* Replies are received in the requests order */
+  new_window->is_pending = true;
+  if(globalconf.windows_pending_tail)
+    globalconf.windows_pending_tail->pending_next = new_window;
+  else
+    globalconf.windows_pending = new_window;
+
+  globalconf.windows_pending_tail = new_window;
+
+  return new_window;
+}
+
+/** Set the attributes and  geometry of a window from the replies once
+ *  they have been received, the state already given by events (which
+ *  is  newer than  or  equal to  the  replies  one) being kept.   Then
+ *  create its Damage object and, if it has been mapped in the
+ *  meantime, get its Pixmap and paint it
+ *
+ * \param window The window object
+ * \param attributes The GetWindowAttributes reply (NULL on error)
+ * \param geometry The GetGeometry reply (NULL on error or if not requested)
+ */
+static void
+window_pending_finalise(unagi_window_t *window,
+                        xcb_get_window_attributes_reply_t *attributes,
+                        xcb_get_geometry_reply_t *geometry)
+{
+  /* The window has been destroyed in the meantime, which will be
+     notified by DestroyNotify, so never paint it until then */
+  if(!attributes)
+    {
+      unagi_debug("GetWindowAttributes failed for window %jx", (uintmax_t) window->id);
+      window->attributes->_class = XCB_WINDOW_CLASS_INPUT_ONLY;
+      free(geometry);
+      return;
+    }
+
+  attributes->map_state = window->attributes->map_state;
+  attributes->override_redirect = window->attributes->override_redirect;
+  free(window->attributes);
+  window->attributes = attributes;
+
+  if(geometry)
     {
-      unagi_window_list_remove_window(new_window, true);
-      return NULL;
+      free(window->geometry);
+      window->geometry = geometry;
+      window->is_region_outdated = true;
     }
 
-  return new_window;
+  if(unagi_window_is_visible(window))
+    {
+      window->pixmap = unagi_window_get_pixmap(window);
+      unagi_window_create_damage(window);
+    }
+}
+
+/** Collect, without blocking, the replies of windows added from event
+ *  handlers.  As replies are  received in  the requests  order, stop at
+ *  the first window whose replies are still pending
+ */
+void
+unagi_window_collect_pending(void)
+{
+  while(globalconf.windows_pending)
+    {
+      unagi_window_t *window = globalconf.windows_pending;
+      xcb_generic_error_t *error = NULL;
+
+      if(window->attributes_cookie.sequence)
+        {
+          void *reply = NULL;
+          if(!xcb_poll_for_reply(globalconf.connection,
+                                 window->attributes_cookie.sequence,
+                                 &reply, &error))
+            return;
+
+          free(error);
+          error = NULL;
+
+          /* Keep it until the geometry is received too */
+          window->attributes_cookie.sequence = 0;
+          window->pending_attributes = reply;
+        }
+
+      void *geometry = NULL;
+      if(window->geometry_cookie.sequence)
+        {
+          if(!xcb_poll_for_reply(globalconf.connection,
+                                 window->geometry_cookie.sequence,
+                                 &geometry, &error))
+            return;
+
+          free(error);
+          window->geometry_cookie.sequence = 0;
+        }
+
+      globalconf.windows_pending = window->pending_next;
+      if(!globalconf.windows_pending)
+        globalconf.windows_pending_tail = NULL;
+
+      window->pending_next = NULL;
+      window->is_pending = false;
+
+      xcb_get_window_attributes_reply_t *attributes = window->pending_attributes;
+      window->pending_attributes = NULL;
+
+      window_pending_finalise(window, attributes, geometry);
+    }
 }
 
 /** Raise and map given window above all other windows. This is just a
@@ -656,57 +1096,157 @@ unagi_window_restack(unagi_window_t *window, xcb_window_t window_new_above_id)
     }
 }
 
-/** Paint all windows  on the screen by calling  the rendering backend
- *  hooks (not all windows may be painted though)
+/** Add the window to the dirty list, meaningful when its damaged ratio
+ *  is set, so that its Damage object is subtracted after painting the
+ *  next frame without walking all the windows
+ *
+ * \param window The window object
+ */
+void
+unagi_window_set_dirty(unagi_window_t *window)
+{
+  if(window->is_dirty)
+    return;
+
+  window->is_dirty = true;
+  window->dirty_next = globalconf.windows_dirty;
+  globalconf.windows_dirty = window;
+}
+
+/** Rebuild the array of windows painted at each frame (the ones already
+ *  damaged), bottommost first, after the stack or these windows changed
+ */
+static void
+window_painted_update(void)
+{
+  globalconf.windows_painted.len = 0;
+
+  for(unagi_window_t *window = globalconf.windows; window; window = window->next)
+    {
+      if(!window->damaged)
+        continue;
+
+      if(globalconf.windows_painted.len == globalconf.windows_painted.size)
+        {
+          globalconf.windows_painted.size = globalconf.windows_painted.size ?
+            globalconf.windows_painted.size * 2 : 64;
+
+          globalconf.windows_painted.windows =
+            realloc(globalconf.windows_painted.windows,
+                    globalconf.windows_painted.size * sizeof(unagi_window_t *));
+        }
+
+      globalconf.windows_painted.windows[globalconf.windows_painted.len++] = window;
+    }
+
+  globalconf.windows_painted.is_outdated = false;
+}
+
+/** Check whether the window overlaps the damaged area bounding box
  *
- * \param windows The list of windows currently managed
+ * \param window The window object
+ * \return true if the window must be painted
+ */
+static inline bool
+window_is_in_damaged_extents(const unagi_window_t *window)
+{
+  const xcb_rectangle_t *extents = &globalconf.damaged_extents;
+
+  xcb_rectangle_t rectangle;
+  unagi_window_get_rectangle(window, &rectangle);
+
+  return (rectangle.x < extents->x + extents->width &&
+          extents->x < rectangle.x + rectangle.width &&
+          rectangle.y < extents->y + extents->height &&
+          extents->y < rectangle.y + rectangle.height);
+}
+
+/** Paint all windows  on the screen by calling  the rendering backend
+ *  hooks.  Only  the windows  overlapping  the damaged  area  are
+ *  painted, and only the dirty ones have their Damage subtracted, thus
+ *  the windows list is not walked unless a repaint is forced
  */
 void
-unagi_window_paint_all(unagi_window_t *windows)
+unagi_window_paint_all(void)
 {
+  /* Do not queue more frames if the X server is lagging behind */
+  unagi_frame_throttle();
+
   /* If the background  is reset, then repaint the  whole screen, it's
      bad from a performance point of view, but it's done rarely */
   if(globalconf.background_reset)
     unagi_display_reset_damaged();
 
-  (*globalconf.rendering->paint_background)();
-
-  for(unagi_window_t *window = windows; window; window = window->next)
-    {
-      if(globalconf.force_repaint && unagi_window_is_visible(window))
+  if(globalconf.force_repaint)
+    for(unagi_window_t *window = globalconf.windows; window; window = window->next)
+      if(unagi_window_is_visible(window))
         {
           window->damaged = true;
           window->damaged_ratio = 1.0;
+          unagi_window_set_dirty(window);
+          globalconf.windows_painted.is_outdated = true;
         }
 
-      if(window->damaged)
+  /* May also extend the damaged area (see unagi_paint_thread_acquire()) */
+  (*globalconf.rendering->paint_background)();
+
+  if(globalconf.windows_painted.is_outdated)
+    window_painted_update();
+
+  /* The whole screen is damaged when there is no damaged Region */
+  const bool is_fully_damaged = !globalconf.damaged;
+
+  for(unsigned int n = 0; n < globalconf.windows_painted.len; n++)
+    {
+      unagi_window_t *window = globalconf.windows_painted.windows[n];
+
+      if(is_fully_damaged || window_is_in_damaged_extents(window))
         {
           (*globalconf.rendering->paint_window)(window);
+          globalconf.stats.windows_painted++;
         }
-      /* When the  window has been damaged  or was damaged but  is not
-         visible anymore */
-      if(window->damaged_ratio)
-        {
-          /* Reset damaged ratio for the next repaint */
-          window->damaged_ratio = 0.0;
-
-          /* And the DamageNotify events counter */
-          window->damage_notify_counter = 0;
-
-          /* Reset  the  damaged  region   in  order  to  get  damages
-             occurring    after   the    repaint,   otherwise,    with
-             DamageReportDeltaRectangles level,  DamageNotify won't be
-             send if  the same region  was already damaged  during the
-             previous repaint */
-          xcb_damage_subtract(globalconf.connection, window->damage,
-                              XCB_NONE, XCB_NONE);
-        }
+    }
+
+  /* The windows which have been damaged or were damaged but are not
+     visible anymore */
+  while(globalconf.windows_dirty)
+    {
+      unagi_window_t *window = globalconf.windows_dirty;
+      globalconf.windows_dirty = window->dirty_next;
+      window->dirty_next = NULL;
+      window->is_dirty = false;
+
+      if(!window->damaged_ratio)
+        continue;
+
+      /* Reset damaged ratio for the next repaint */
+      window->damaged_ratio = 0.0;
+
+      /* And the DamageNotify events counter */
+      window->damage_notify_counter = 0;
+
+      /* Reset  the  damaged  region   in  order  to  get  damages
+         occurring    after   the    repaint,   otherwise,    with
+         DamageReportDeltaRectangles level,  DamageNotify won't be
+         send if  the same region  was already damaged  during the
+         previous repaint */
+      if(window->damage != XCB_NONE)
+        xcb_damage_subtract(globalconf.connection, window->damage,
+                            XCB_NONE, XCB_NONE);
     }
 
   xcb_flush(globalconf.connection);
-  vsync_wait();
+
+  /* Otherwise the paint thread waits for VBlank before presenting, and
+     immediate frames do not wait for it at all */
+  if(!globalconf.paint_thread && !globalconf.paint_immediate)
+    vsync_wait();
+
   (*globalconf.rendering->paint_all)();
 
   globalconf.background_reset = false;
-  xcb_aux_sync(globalconf.connection);
+
+  /* Rather than a  round trip to wait for the X  server to process the
+     frame, only keep track of it */
+  unagi_frame_submit();
 }